@@ -0,0 +1,146 @@
+// Time full tile-smush runs and report throughput and peak memory.
+//
+// tile-smush is run as a child process (or, with --shards, one process per
+// shard, as tile-smush-parallel would), so that its peak RSS can be read
+// from wait4's rusage.
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "external/sqlite_modern_cpp.h"
+#include "helpers.h"
+
+#define BENCH_OUTPUT "bench-merged.mbtiles"
+
+struct Run {
+	double seconds;
+	uint64_t tiles;
+	uint64_t bytesOut;
+	long maxRssKb; // largest single process
+	long sumRssKb; // all shards together
+};
+
+static void usage() {
+	std::cerr << "usage: tile-smush-bench [--runs N] [--shards N] [--tile-smush PATH] input... [-- tile-smush args...]" << std::endl;
+}
+
+static Run runOnce(const std::string& binary, unsigned int shards, const std::vector<std::string>& args) {
+	// Start from scratch, along with SQLite's journal files.
+	for (const char* suffix : { "", "-wal", "-shm" })
+		remove((std::string(BENCH_OUTPUT) + suffix).c_str());
+
+	std::vector<const char*> argv;
+	argv.push_back(binary.c_str());
+	argv.push_back("--output");
+	argv.push_back(BENCH_OUTPUT);
+	for (const auto& arg : args)
+		argv.push_back(arg.c_str());
+	argv.push_back(NULL);
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<pid_t> pids;
+	for (unsigned int shard = 0; shard < shards; shard++) {
+		pid_t pid = fork();
+		if (pid == -1)
+			throw std::runtime_error("fork failed");
+
+		if (pid == 0) {
+			int devnull = open("/dev/null", O_WRONLY);
+			dup2(devnull, STDOUT_FILENO);
+			setenv("SHARDS", std::to_string(shards).c_str(), 1);
+			setenv("SHARD", std::to_string(shard).c_str(), 1);
+			execv(binary.c_str(), (char* const*)argv.data());
+			perror("execv");
+			_exit(127);
+		}
+		pids.push_back(pid);
+	}
+
+	Run run = {};
+	bool failed = false;
+	for (pid_t pid : pids) {
+		int status;
+		struct rusage usage;
+		wait4(pid, &status, 0, &usage);
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			failed = true;
+		run.maxRssKb = std::max(run.maxRssKb, usage.ru_maxrss);
+		run.sumRssKb += usage.ru_maxrss;
+	}
+	run.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	if (failed)
+		throw std::runtime_error(binary + " failed");
+
+	sqlite::database db;
+	db.init(BENCH_OUTPUT, SQLITE_OPEN_READONLY);
+	db << "SELECT COUNT(*), COALESCE(SUM(LENGTH(tile_data)), 0) FROM tiles" >> [&](sqlite3_int64 tiles, sqlite3_int64 bytes) {
+		run.tiles = tiles;
+		run.bytesOut = bytes;
+	};
+
+	return run;
+}
+
+int main(const int argc, const char* argv[]) {
+	unsigned int runs = 3;
+	unsigned int shards = 1;
+	std::string binary = "./tile-smush";
+	std::vector<std::string> inputs;
+	std::vector<std::string> extra;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg(argv[i]);
+		if (arg == "--runs" && i + 1 < argc) runs = atoi(argv[++i]);
+		else if (arg == "--shards" && i + 1 < argc) shards = atoi(argv[++i]);
+		else if (arg == "--tile-smush" && i + 1 < argc) binary = argv[++i];
+		else if (arg == "--") {
+			extra.assign(argv + i + 1, argv + argc);
+			break;
+		} else
+			inputs.push_back(arg);
+	}
+
+	if (inputs.empty() || runs == 0 || shards == 0) {
+		usage();
+		return 1;
+	}
+
+	uint64_t bytesIn = 0;
+	for (const auto& input : inputs)
+		if (!isDirectory(input))
+			bytesIn += getFileSize(input);
+
+	std::vector<std::string> args = extra;
+	args.insert(args.end(), inputs.begin(), inputs.end());
+
+	std::vector<Run> results;
+	for (unsigned int i = 0; i < runs; i++) {
+		Run run = runOnce(binary, shards, args);
+		results.push_back(run);
+
+		printf("run %u: %.3fs, %" PRIu64 " tiles, %.0f tiles/s, %.1f MB/s in, %.1f MB/s out, peak RSS %.1f MB (%.1f MB over %u shards)\n",
+			i + 1, run.seconds, run.tiles, run.tiles / run.seconds,
+			bytesIn / run.seconds / 1e6, run.bytesOut / run.seconds / 1e6,
+			run.maxRssKb / 1024.0, run.sumRssKb / 1024.0, shards);
+	}
+
+	std::sort(results.begin(), results.end(), [](const Run& a, const Run& b) { return a.seconds < b.seconds; });
+	const Run& best = results.front();
+	const Run& median = results[results.size() / 2];
+	printf("best: %.3fs, %.0f tiles/s, %.1f MB/s in; median: %.3fs, %.0f tiles/s, %.1f MB/s in\n",
+		best.seconds, best.tiles / best.seconds, bytesIn / best.seconds / 1e6,
+		median.seconds, median.tiles / median.seconds, bytesIn / median.seconds / 1e6);
+
+	return 0;
+}
@@ -0,0 +1,128 @@
+// Generate synthetic MBTiles inputs for benchmarking tile-smush.
+//
+// Every input gets the same number of tiles at a single zoom. A fraction of
+// those tiles (--overlap) are present in every input, and so have to be
+// merged; the rest are unique to one input and are copied as-is. Each input
+// has its own layers, so the inputs can be merged by concatenation, as
+// tile-smush expects.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "helpers.h"
+#include "mbtiles.h"
+#include "synthetic.h"
+
+struct Options {
+	std::string prefix = "bench";
+	unsigned int inputs = 2;
+	unsigned int tiles = 10000;
+	unsigned int layers = 2;
+	unsigned int tileBytes = 20000;
+	double overlap = 0.5;
+	unsigned int zoom = 12;
+	unsigned int seed = 1;
+};
+
+static void usage() {
+	std::cerr << "usage: tile-smush-bench-generate [options]" << std::endl;
+	std::cerr << "  --prefix NAME       write NAME-0.mbtiles, NAME-1.mbtiles, ... (default bench)" << std::endl;
+	std::cerr << "  --inputs N          number of inputs to write (default 2)" << std::endl;
+	std::cerr << "  --tiles N           tiles per input (default 10000)" << std::endl;
+	std::cerr << "  --layers N          layers per tile in each input (default 2)" << std::endl;
+	std::cerr << "  --tile-bytes N      approximate uncompressed size of each input's tiles (default 20000)" << std::endl;
+	std::cerr << "  --overlap R         fraction of each input's tiles that all inputs share (default 0.5)" << std::endl;
+	std::cerr << "  --zoom Z            zoom to write tiles at (default 12)" << std::endl;
+	std::cerr << "  --seed N            random seed (default 1)" << std::endl;
+}
+
+int main(const int argc, const char* argv[]) {
+	Options options;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg(argv[i]);
+		if (i + 1 >= argc) {
+			usage();
+			return 1;
+		}
+
+		const char* value = argv[++i];
+		if (arg == "--prefix") options.prefix = value;
+		else if (arg == "--inputs") options.inputs = atoi(value);
+		else if (arg == "--tiles") options.tiles = atoi(value);
+		else if (arg == "--layers") options.layers = atoi(value);
+		else if (arg == "--tile-bytes") options.tileBytes = atoi(value);
+		else if (arg == "--overlap") options.overlap = atof(value);
+		else if (arg == "--zoom") options.zoom = atoi(value);
+		else if (arg == "--seed") options.seed = atoi(value);
+		else {
+			usage();
+			return 1;
+		}
+	}
+
+	if (options.inputs == 0 || options.layers == 0 || options.overlap < 0 || options.overlap > 1 || options.zoom > 14) {
+		usage();
+		return 1;
+	}
+
+	// Tiles are numbered 0..distinct-1 and laid out row by row in a square
+	// in the middle of the zoom. Tiles [0, shared) are in every input; after
+	// that, each input has its own run of `unique` tiles.
+	const uint64_t shared = std::llround(options.tiles * options.overlap);
+	const uint64_t unique = options.tiles - shared;
+	const uint64_t distinct = shared + unique * options.inputs;
+	const uint64_t side = std::ceil(std::sqrt((double)distinct));
+	const uint64_t dimension = 1ull << options.zoom;
+	if (side > dimension) {
+		std::cerr << "fatal: " << std::to_string(distinct) << " tiles don't fit in z" << std::to_string(options.zoom) << std::endl;
+		return 1;
+	}
+	const uint64_t origin = (dimension - side) / 2;
+
+	for (unsigned int input = 0; input < options.inputs; input++) {
+		std::string filename = options.prefix + "-" + std::to_string(input) + ".mbtiles";
+		remove(filename.c_str());
+
+		MBTiles mbtiles;
+		mbtiles.openForWriting(filename);
+
+		std::string vectorLayers;
+		for (unsigned int l = 0; l < options.layers; l++) {
+			if (l > 0)
+				vectorLayers += ",";
+			vectorLayers += "{\"id\":\"input" + std::to_string(input) + "_layer" + std::to_string(l) + "\",\"fields\":{\"class\":\"String\",\"rank\":\"Number\"}}";
+		}
+
+		mbtiles.writeMetadata("name", filename);
+		mbtiles.writeMetadata("format", "pbf");
+		mbtiles.writeMetadata("minzoom", std::to_string(options.zoom));
+		mbtiles.writeMetadata("maxzoom", std::to_string(options.zoom));
+		mbtiles.writeMetadata("bounds", "-180,-85,180,85");
+		mbtiles.writeMetadata("json", "{\"vector_layers\":[" + vectorLayers + "]}");
+
+		std::mt19937 rng(options.seed * 1000 + input);
+		uint64_t bytes = 0;
+		auto writeTile = [&](uint64_t i) {
+			std::string tile = makeSyntheticTile(rng, "input" + std::to_string(input), options.layers, options.tileBytes);
+			std::string compressed = compress_string(tile, 6, true);
+			bytes += compressed.size();
+			mbtiles.saveTile(options.zoom, origin + i % side, origin + i / side, &compressed, false);
+		};
+
+		for (uint64_t i = 0; i < shared; i++)
+			writeTile(i);
+		for (uint64_t i = 0; i < unique; i++)
+			writeTile(shared + input * unique + i);
+
+		mbtiles.closeForWriting();
+		std::cout << filename << ": " << std::to_string(options.tiles) << " tiles, " << std::to_string(bytes) << " bytes of compressed tiles" << std::endl;
+	}
+
+	return 0;
+}
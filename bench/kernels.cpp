@@ -0,0 +1,207 @@
+// Microbenchmarks for the per-tile kernels that tile-smush spends its time in:
+// compression at each level, decompression, the vtzero merge, and MBTiles
+// tile writes and reads.
+//
+// Kernels run over a corpus of tiles, either read from an existing MBTiles
+// file (--corpus) or generated synthetically. Each kernel is repeated until
+// it has run for at least --min-time seconds, then ns/op and the bytes
+// consumed and produced per op are reported.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+#include <vtzero/builder.hpp>
+
+#include "external/sqlite_modern_cpp.h"
+#include "helpers.h"
+#include "mbtiles.h"
+#include "synthetic.h"
+
+#define KERNELS_MBTILES "bench-kernels.mbtiles"
+
+struct Tile {
+	std::string raw;
+	std::string compressed;
+};
+
+static double minSeconds = 0.5;
+
+static void report(const std::string& name, uint64_t ops, double seconds, uint64_t bytesIn, uint64_t bytesOut) {
+	printf("%-24s %12.0f ns/op %10.0f in/op %10.0f out/op %10lu ops\n",
+		name.c_str(), seconds * 1e9 / ops, (double)bytesIn / ops, (double)bytesOut / ops, ops);
+}
+
+// Run fn over the corpus until minSeconds have passed. fn returns the bytes
+// it consumed and produced.
+static void measure(const std::string& name, size_t corpusSize, const std::function<std::pair<size_t, size_t>(size_t)>& fn) {
+	uint64_t ops = 0, bytesIn = 0, bytesOut = 0;
+	auto start = std::chrono::steady_clock::now();
+	double seconds = 0;
+	while (seconds < minSeconds) {
+		for (size_t i = 0; i < corpusSize; i++) {
+			auto bytes = fn(i);
+			bytesIn += bytes.first;
+			bytesOut += bytes.second;
+			ops++;
+		}
+		seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	report(name, ops, seconds, bytesIn, bytesOut);
+}
+
+static void usage() {
+	std::cerr << "usage: tile-smush-bench-kernels [options]" << std::endl;
+	std::cerr << "  --corpus FILE.mbtiles  take tiles from FILE rather than generating them" << std::endl;
+	std::cerr << "  --tiles N              number of tiles in the corpus (default 200)" << std::endl;
+	std::cerr << "  --layers N             layers per synthetic tile (default 4)" << std::endl;
+	std::cerr << "  --tile-bytes N         uncompressed size of synthetic tiles (default 50000)" << std::endl;
+	std::cerr << "  --min-time S           run each kernel for at least S seconds (default 0.5)" << std::endl;
+}
+
+int main(const int argc, const char* argv[]) {
+	std::string corpusFilename;
+	unsigned int corpusTiles = 200;
+	unsigned int layers = 4;
+	unsigned int tileBytes = 50000;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg(argv[i]);
+		if (i + 1 >= argc) {
+			usage();
+			return 1;
+		}
+
+		const char* value = argv[++i];
+		if (arg == "--corpus") corpusFilename = value;
+		else if (arg == "--tiles") corpusTiles = atoi(value);
+		else if (arg == "--layers") layers = atoi(value);
+		else if (arg == "--tile-bytes") tileBytes = atoi(value);
+		else if (arg == "--min-time") minSeconds = atof(value);
+		else {
+			usage();
+			return 1;
+		}
+	}
+
+	std::vector<Tile> corpus;
+	if (!corpusFilename.empty()) {
+		sqlite::database db;
+		db.init(corpusFilename, SQLITE_OPEN_READONLY);
+		db << "SELECT tile_data FROM tiles WHERE length(tile_data) <> 20 LIMIT ?" << (int)corpusTiles >> [&](std::vector<char> blob) {
+			Tile tile;
+			tile.compressed.assign(blob.data(), blob.size());
+			decompress_tile(tile.raw, tile.compressed.data(), tile.compressed.size());
+			// Normalise to gzip, which is what the merge path produces by default.
+			tile.compressed = compress_string(tile.raw, 6, true);
+			corpus.push_back(std::move(tile));
+		};
+	} else {
+		std::mt19937 rng(1);
+		for (unsigned int i = 0; i < corpusTiles; i++) {
+			Tile tile;
+			tile.raw = makeSyntheticTile(rng, "synthetic", layers, tileBytes);
+			tile.compressed = compress_string(tile.raw, 6, true);
+			corpus.push_back(std::move(tile));
+		}
+	}
+
+	if (corpus.empty()) {
+		std::cerr << "fatal: the corpus is empty" << std::endl;
+		return 1;
+	}
+
+	uint64_t rawBytes = 0, compressedBytes = 0;
+	for (const auto& tile : corpus) {
+		rawBytes += tile.raw.size();
+		compressedBytes += tile.compressed.size();
+	}
+	printf("corpus: %zu tiles, %.0f bytes raw and %.0f bytes gzipped on average\n\n",
+		corpus.size(), (double)rawBytes / corpus.size(), (double)compressedBytes / corpus.size());
+
+	// compress_string at each level libdeflate supports
+	for (int level = 0; level <= 12; level++) {
+		measure("compress/level=" + std::to_string(level), corpus.size(), [&](size_t i) {
+			std::string compressed = compress_string(corpus[i].raw, level, true);
+			return std::make_pair(corpus[i].raw.size(), compressed.size());
+		});
+	}
+
+	// A cold decompress allocates its output buffer every time; a warm one
+	// reuses the buffer, as the merge loop can.
+	measure("decompress/cold", corpus.size(), [&](size_t i) {
+		std::string output;
+		decompress_string(output, corpus[i].compressed.data(), corpus[i].compressed.size(), true);
+		return std::make_pair(corpus[i].compressed.size(), output.size());
+	});
+
+	std::string warm;
+	measure("decompress/warm", corpus.size(), [&](size_t i) {
+		decompress_string(warm, corpus[i].compressed.data(), corpus[i].compressed.size(), true);
+		return std::make_pair(corpus[i].compressed.size(), warm.size());
+	});
+
+	// Merge two neighbouring corpus tiles the way the merge loop does.
+	measure("merge/2 tiles", corpus.size(), [&](size_t i) {
+		const std::string& a = corpus[i].raw;
+		const std::string& b = corpus[(i + 1) % corpus.size()].raw;
+
+		vtzero::tile_builder builder;
+		for (const std::string* raw : { &a, &b }) {
+			vtzero::vector_tile tile{*raw};
+			while (auto layer = tile.next_layer())
+				builder.add_existing_layer(layer);
+		}
+
+		std::string buffer;
+		builder.serialize(buffer);
+		return std::make_pair(a.size() + b.size(), buffer.size());
+	});
+
+	// MBTiles round trip: save every tile (including the final flush), then
+	// read them all back.
+	{
+		std::string filename = KERNELS_MBTILES;
+		uint64_t ops = 0, bytes = 0;
+		double saveSeconds = 0, readSeconds = 0;
+		while (saveSeconds + readSeconds < minSeconds * 2) {
+			for (const char* suffix : { "", "-wal", "-shm" })
+				remove((filename + suffix).c_str());
+
+			auto start = std::chrono::steady_clock::now();
+			{
+				MBTiles mbtiles;
+				mbtiles.openForWriting(filename);
+				for (size_t i = 0; i < corpus.size(); i++)
+					mbtiles.saveTile(14, i, 0, &corpus[i].compressed, false);
+				mbtiles.closeForWriting();
+			}
+			auto saved = std::chrono::steady_clock::now();
+
+			MBTiles mbtiles;
+			mbtiles.openForReading(filename);
+			std::vector<char> buffer;
+			for (size_t i = 0; i < corpus.size(); i++)
+				bytes += mbtiles.readTile(14, i, 0, buffer).size();
+			auto read = std::chrono::steady_clock::now();
+
+			saveSeconds += std::chrono::duration<double>(saved - start).count();
+			readSeconds += std::chrono::duration<double>(read - saved).count();
+			ops += corpus.size();
+		}
+
+		report("mbtiles/saveTile", ops, saveSeconds, bytes, 0);
+		report("mbtiles/readTile", ops, readSeconds, 0, bytes);
+
+		for (const char* suffix : { "", "-wal", "-shm" })
+			remove((filename + suffix).c_str());
+	}
+
+	return 0;
+}
@@ -0,0 +1,47 @@
+#include "synthetic.h"
+#include <algorithm>
+#include <vtzero/builder.hpp>
+
+// A linestring feature with this many points, plus its properties, comes out
+// at roughly this many bytes before compression.
+#define POINTS_PER_FEATURE 16
+#define BYTES_PER_FEATURE 60
+
+std::string makeSyntheticTile(std::mt19937& rng, const std::string& layerPrefix, unsigned int layers, unsigned int tileBytes) {
+	static const char* classes[] = { "primary", "secondary", "tertiary", "residential", "service", "path" };
+	std::uniform_int_distribution<int> coord(0, 4095);
+	std::uniform_int_distribution<int> step(1, 64);
+	std::uniform_int_distribution<int> sign(0, 1);
+	std::uniform_int_distribution<int> klass(0, 5);
+	std::uniform_int_distribution<int> rank(0, 20);
+
+	const unsigned int featuresPerLayer = std::max(1u, tileBytes / std::max(1u, layers) / BYTES_PER_FEATURE);
+
+	vtzero::tile_builder tile;
+	for (unsigned int l = 0; l < layers; l++) {
+		std::string name = layerPrefix + "_layer" + std::to_string(l);
+		vtzero::layer_builder layer{tile, name};
+
+		for (unsigned int f = 0; f < featuresPerLayer; f++) {
+			vtzero::linestring_feature_builder feature{layer};
+			feature.set_id(f);
+			feature.add_linestring(POINTS_PER_FEATURE);
+
+			int x = coord(rng), y = coord(rng);
+			for (int p = 0; p < POINTS_PER_FEATURE; p++) {
+				feature.set_point(x, y);
+				// Steps are never zero, so there are no zero-length segments.
+				x += sign(rng) ? step(rng) : -step(rng);
+				y += sign(rng) ? step(rng) : -step(rng);
+			}
+
+			feature.add_property("class", classes[klass(rng)]);
+			feature.add_property("rank", vtzero::sint_value_type(rank(rng)));
+			feature.commit();
+		}
+	}
+
+	std::string buffer;
+	tile.serialize(buffer);
+	return buffer;
+}
@@ -0,0 +1,12 @@
+#ifndef _BENCH_SYNTHETIC_H
+#define _BENCH_SYNTHETIC_H
+
+#include <random>
+#include <string>
+
+// Build an uncompressed vector tile with `layers` layers named
+// `<layerPrefix>_layer<N>`, each of about `tileBytes / layers` bytes of
+// random linestrings.
+std::string makeSyntheticTile(std::mt19937& rng, const std::string& layerPrefix, unsigned int layers, unsigned int tileBytes);
+
+#endif //_BENCH_SYNTHETIC_H
@@ -0,0 +1,105 @@
+/*! \file */
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+/** \brief A bump allocator for scratch memory that's all freed at once
+*
+* Each worker thread keeps one, and reset()s it at the start of every tile.
+* allocate() just bumps an offset into the current chunk, starting a new
+* chunk when that's full; nothing is freed individually. reset() keeps the
+* memory, and if the last tile needed more than one chunk it swaps them for
+* a single chunk big enough for all of them, so that after the first few
+* tiles a worker's scratch is one block that's never returned to the heap.
+*/
+class Arena {
+	std::vector<std::unique_ptr<char[]>> chunks;
+	std::vector<size_t> chunkSizes;
+	size_t current;
+	size_t offset;
+	size_t minChunkSize;
+
+	void addChunk(size_t bytes) {
+		bytes = std::max(bytes, minChunkSize);
+		chunks.emplace_back(new char[bytes]);
+		chunkSizes.push_back(bytes);
+		current = chunks.size() - 1;
+		offset = 0;
+	}
+
+public:
+	explicit Arena(size_t minChunkSize = 64 * 1024):
+		current(0), offset(0), minChunkSize(minChunkSize) {}
+
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	void* allocate(size_t bytes, size_t alignment = alignof(std::max_align_t)) {
+		while (current < chunks.size()) {
+			uintptr_t base = reinterpret_cast<uintptr_t>(chunks[current].get());
+			size_t start = ((base + offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base;
+			if (start + bytes <= chunkSizes[current]) {
+				offset = start + bytes;
+				return chunks[current].get() + start;
+			}
+			current++;
+			offset = 0;
+		}
+
+		addChunk(bytes + alignment);
+		return allocate(bytes, alignment);
+	}
+
+	/// Forget everything allocated so far, keeping the memory.
+	void reset() {
+		if (chunks.size() > 1) {
+			size_t total = capacity();
+			chunks.clear();
+			chunkSizes.clear();
+			addChunk(total);
+		}
+		current = 0;
+		offset = 0;
+	}
+
+	size_t capacity() const {
+		size_t total = 0;
+		for (size_t size : chunkSizes)
+			total += size;
+		return total;
+	}
+};
+
+/// An STL allocator that takes its memory from an Arena. deallocate() does
+/// nothing, so containers using it must not outlive the arena's next reset().
+template <typename T>
+class ArenaAllocator {
+public:
+	using value_type = T;
+
+	Arena* arena;
+
+	explicit ArenaAllocator(Arena& arena): arena(&arena) {}
+
+	template <typename U>
+	ArenaAllocator(const ArenaAllocator<U>& other): arena(other.arena) {}
+
+	T* allocate(size_t n) {
+		return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T*, size_t) {}
+
+	template <typename U>
+	bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+	template <typename U>
+	bool operator!=(const ArenaAllocator<U>& other) const { return arena != other.arena; }
+};
+
+#endif //_ARENA_H
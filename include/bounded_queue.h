@@ -0,0 +1,168 @@
+/*! \file */
+#ifndef _BOUNDED_QUEUE_H
+#define _BOUNDED_QUEUE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+#include "stats.h"
+
+/** \brief A bounded multi-producer, multi-consumer queue between pipeline stages
+*
+* Slots are claimed with a compare-and-swap on the head or the tail, as in
+* Dmitry Vyukov's bounded MPMC queue, so pushing and popping never take a
+* lock. A producer that finds the queue full, or a consumer that finds it
+* empty, backs off (yielding, then sleeping for up to a millisecond), and that
+* time counts as Stage::QueueWait. A full queue is the backpressure: the
+* slowest stage fills the queue in front of it and everything upstream waits.
+*
+* The queue knows how many producers it has. Once they've all called close(),
+* pop() drains what's left and then returns false. abort() makes every push
+* and pop return false at once, so a failing stage can stop the others.
+*/
+template <typename T>
+class BoundedQueue {
+	struct Slot {
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	std::unique_ptr<Slot[]> slots;
+	size_t mask;
+
+	alignas(64) std::atomic<size_t> tail;
+	alignas(64) std::atomic<size_t> head;
+	alignas(64) std::atomic<int> producers;
+	std::atomic<bool> aborted;
+	std::atomic<uint64_t> blockedPushes_;
+	std::atomic<uint64_t> blockedPops_;
+
+	bool tryPush(T& value) {
+		size_t pos = tail.load(std::memory_order_relaxed);
+		for (;;) {
+			Slot& slot = slots[pos & mask];
+			size_t sequence = slot.sequence.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+			if (diff == 0) {
+				if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					slot.value = std::move(value);
+					slot.sequence.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = tail.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	bool tryPop(T& value) {
+		size_t pos = head.load(std::memory_order_relaxed);
+		for (;;) {
+			Slot& slot = slots[pos & mask];
+			size_t sequence = slot.sequence.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+			if (diff == 0) {
+				if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					value = std::move(slot.value);
+					slot.sequence.store(pos + mask + 1, std::memory_order_release);
+					return true;
+				}
+			} else if (diff < 0) {
+				return false;
+			} else {
+				pos = head.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	static void backOff(unsigned int& attempt) {
+		if (attempt < 16)
+			std::this_thread::yield();
+		else
+			std::this_thread::sleep_for(std::chrono::microseconds(std::min(1000u, 10u << std::min(attempt - 16, 7u))));
+		attempt++;
+	}
+
+public:
+	/// capacity is rounded up to a power of two.
+	BoundedQueue(size_t capacity, int producers):
+		tail(0),
+		head(0),
+		producers(producers),
+		aborted(false),
+		blockedPushes_(0),
+		blockedPops_(0)
+	{
+		size_t size = 2;
+		while (size < capacity)
+			size *= 2;
+
+		slots.reset(new Slot[size]);
+		mask = size - 1;
+		for (size_t i = 0; i < size; i++)
+			slots[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	/// Wait for room, then push. Returns false if the queue was aborted.
+	bool push(T value) {
+		if (tryPush(value))
+			return true;
+
+		blockedPushes_.fetch_add(1, std::memory_order_relaxed);
+		StageTimer timer(Stage::QueueWait);
+		unsigned int attempt = 0;
+		while (!aborted.load(std::memory_order_relaxed)) {
+			backOff(attempt);
+			if (tryPush(value))
+				return true;
+		}
+		return false;
+	}
+
+	/// Wait for a value. Returns false once every producer has closed the
+	/// queue and it's empty, or if it was aborted.
+	bool pop(T& value) {
+		if (tryPop(value))
+			return true;
+
+		blockedPops_.fetch_add(1, std::memory_order_relaxed);
+		StageTimer timer(Stage::QueueWait);
+		unsigned int attempt = 0;
+		while (!aborted.load(std::memory_order_relaxed)) {
+			// Check for producers first, so a push that lands just before the
+			// last close still gets popped.
+			bool closed = producers.load(std::memory_order_acquire) == 0;
+			if (tryPop(value))
+				return true;
+			if (closed)
+				return false;
+			backOff(attempt);
+		}
+		return false;
+	}
+
+	/// Called by each producer when it's done pushing.
+	void close() { producers.fetch_sub(1, std::memory_order_release); }
+	void abort() { aborted.store(true); }
+
+	size_t capacity() const { return mask + 1; }
+
+	/// Approximate when there are concurrent pushes and pops.
+	size_t size() const {
+		size_t t = tail.load(std::memory_order_relaxed);
+		size_t h = head.load(std::memory_order_relaxed);
+		return t > h ? std::min(t - h, mask + 1) : 0;
+	}
+
+	uint64_t blockedPushes() const { return blockedPushes_.load(std::memory_order_relaxed); }
+	uint64_t blockedPops() const { return blockedPops_.load(std::memory_order_relaxed); }
+};
+
+#endif //_BOUNDED_QUEUE_H
@@ -0,0 +1,74 @@
+/*! \file */
+#ifndef _DIRECTORY_TILES_H
+#define _DIRECTORY_TILES_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "mbtiles.h"
+#include "tile_source.h"
+#include "tile_sink.h"
+
+/** \brief Read and write tiles as a z/x/y.pbf directory tree
+*
+* Tiles are stored as-is, i.e. still compressed, and y is in the XYZ
+* convention on disk. Metadata is kept as a flat JSON object of strings in
+* metadata.json, like tippecanoe's --output-to-directory.
+*
+* Writes are fanned out across threads. Each tile column is owned by exactly
+* one writer thread, so a thread can keep its current column's directory open
+* and create files with openat without coordinating with the others.
+* Nothing is fsynced.
+*/
+class DirectoryTiles : public TileSource, public TileSink {
+	struct Writer {
+		std::thread thread;
+		std::mutex mutex;
+		std::condition_variable cv;
+		std::deque<PendingStatement> queue;
+		bool closing = false;
+	};
+
+	std::string filename;
+	int rootfd;
+	unsigned int threads;
+
+	// Writing
+	std::vector<std::unique_ptr<Writer>> writers;
+	std::map<std::string, std::string> metadata;
+	std::atomic<bool> failed;
+	std::mutex errorMutex;
+	std::exception_ptr error;
+
+	void writeTiles(Writer& writer);
+	void writeFile(int dirfd, const std::string& name, const char* data, size_t size);
+
+	// Reading
+	Bbox maxZoomExtent;
+	int minZoom;
+	int maxZoom;
+
+public:
+	DirectoryTiles(unsigned int threads);
+	virtual ~DirectoryTiles();
+
+	void openForWriting(std::string &filename) override;
+	void writeMetadata(std::string key, std::string value) override;
+	void saveTile(int zoom, int x, int y, std::string *data, bool isMerge) override;
+	void closeForWriting() override;
+
+	void openForReading(std::string &filename) override;
+	std::vector<std::pair<std::string, std::string>> readMetadata() override;
+	void readBoundingBox(double &minLon, double &maxLon, double &minLat, double &maxLat) override;
+	void populateTiles(bool verbose, std::vector<PreciseTileCoordinatesSet>& zooms, std::vector<Bbox>& extents) override;
+	protozero::data_view readTile(int zoom, int col, int row, std::vector<char>& buffer) override;
+};
+
+#endif //_DIRECTORY_TILES_H
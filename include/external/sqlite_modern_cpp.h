@@ -6,6 +6,7 @@
 #include <stdexcept>
 #include <ctime>
 #include <tuple>
+#include <map>
 #include <memory>
 #include <vector>
 
@@ -94,6 +95,12 @@ namespace sqlite {
 	class database;
 	class database_binder;
 
+	// A column's bytes, still owned by SQLite.
+	struct blob_view {
+		const char* data;
+		size_t size;
+	};
+
 	template<std::size_t> class binder;
 
 	typedef std::shared_ptr<sqlite3> connection_type;
@@ -144,6 +151,23 @@ namespace sqlite {
 		void used(bool state) { execution_started = state; }
 		bool used() const { return execution_started; }
 
+		// Step to the first row and return a view of column inx as a blob,
+		// without copying it. The view is only valid until the statement is
+		// next reset or stepped. If there are no rows, the view is empty.
+		blob_view single_blob(int inx = 0) {
+			execution_started = true;
+			int hresult = sqlite3_step(_stmt.get());
+			if(hresult == SQLITE_DONE) {
+				return { nullptr, 0 };
+			}
+			if(hresult != SQLITE_ROW) {
+				exceptions::throw_sqlite_error(hresult);
+			}
+
+			const char* data = reinterpret_cast<const char*>(sqlite3_column_blob(_stmt.get(), inx));
+			return { data, static_cast<size_t>(sqlite3_column_bytes(_stmt.get(), inx)) };
+		}
+
 	private:
 		std::shared_ptr<sqlite3> _db;
 		std::u16string _sql;
@@ -294,6 +318,8 @@ namespace sqlite {
 	private:
 		std::shared_ptr<sqlite3> _db;
 		bool _connected = false;
+		std::shared_ptr<std::map<std::string, std::unique_ptr<database_binder>>> _prepared =
+			std::make_shared<std::map<std::string, std::unique_ptr<database_binder>>>();
 
 	public:
 		database() {};
@@ -343,6 +369,18 @@ namespace sqlite {
 
 		connection_type connection() const { return _db; }
 
+		// A statement that's prepared the first time it's asked for and
+		// reused after that. reset() it before binding new values.
+		database_binder& prepared(const std::string& sql) {
+			auto it = _prepared->find(sql);
+			if(it == _prepared->end()) {
+				std::unique_ptr<database_binder> binder(new database_binder(_db, sql));
+				binder->used(true); // never run it just because it's destroyed
+				it = _prepared->emplace(sql, std::move(binder)).first;
+			}
+			return *it->second;
+		}
+
 		sqlite3_int64 last_insert_rowid() const {
 			return sqlite3_last_insert_rowid(_db.get());
 		}
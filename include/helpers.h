@@ -3,6 +3,7 @@
 #define _HELPERS_H
 
 #include <sstream>
+#include <string>
 #include <vector>
 
 #define Z_DEFAULT_COMPRESSION -1
@@ -35,6 +36,7 @@ struct OffsetAndLength {
 };
 
 uint64_t getFileSize(std::string filename);
+bool isDirectory(const std::string& filename);
 std::vector<OffsetAndLength> getNewlineChunks(const std::string &filename, uint64_t chunks);
 
 void decompress_string(std::string& output, const char* input, uint32_t inputSize, bool asGzip = false);
@@ -43,6 +45,39 @@ std::string compress_string(const std::string& str,
                             int compressionlevel = Z_DEFAULT_COMPRESSION,
                             bool asGzip = false);
 
+// Codecs a tile can be stored with. Inputs are detected per tile by their
+// magic bytes; the output codec is chosen on the command line.
+enum class TileCompression { None, Gzip, Zlib };
+
+TileCompression detect_compression(const char* input, size_t inputSize);
+bool parse_compression(const std::string& name, TileCompression& compression);
+const char* compression_name(TileCompression compression);
+
+// Decompress a tile of any supported codec. Uncompressed tiles are copied as-is.
+void decompress_tile(std::string& output, const char* input, size_t inputSize);
+std::string compress_tile(const std::string& str, TileCompression compression, int compressionlevel);
+
+// Parse a compression level schedule: either a single level for every zoom
+// (e.g. "6"), or comma-separated zoom ranges (e.g. "0-8:12,9-12:9,13-14:4").
+// Zooms that a schedule doesn't mention keep whatever level they had.
+bool parse_zoom_levels(const std::string& spec, std::vector<int>& levels);
+
+// CPU time used by the calling thread, in seconds.
+double getThreadCpuSeconds();
+
+// The calling process's counters from /proc/self/io (rchar, read_bytes, ...),
+// or nothing where that isn't available.
+std::vector<std::pair<std::string, int64_t>> readProcessIo();
+
+// after - before, for each counter in after.
+std::vector<std::pair<std::string, int64_t>> ioDelta(const std::vector<std::pair<std::string, int64_t>>& before, const std::vector<std::pair<std::string, int64_t>>& after);
+
+// Quote a string for use in JSON.
+std::string escapeJsonString(const std::string& str);
+
+// Append a code point (e.g. from a JSON \u escape) as UTF-8.
+void appendUtf8(std::string& str, uint32_t cp);
+
 std::string boost_validity_error(unsigned failure);
 
 #endif //_HELPERS_H
@@ -0,0 +1,50 @@
+/*! \file */
+#ifndef _JSON_H
+#define _JSON_H
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// A parsed JSON document, just enough to read the `json` metadata of inputs.
+struct JsonValue {
+	enum class Type { Null, Boolean, Number, String, Array, Object };
+
+	Type type = Type::Null;
+	bool boolean = false;
+	double number = 0;
+	// A string's value, or a number's text as it was written.
+	std::string string;
+	std::vector<JsonValue> array;
+	std::vector<std::pair<std::string, JsonValue>> object;
+
+	/// The member named `key` of an object, or NULL.
+	const JsonValue* get(const std::string& key) const;
+	JsonValue* get(const std::string& key);
+};
+
+/// Throws std::runtime_error if `json` isn't valid JSON.
+JsonValue parseJson(const std::string& json);
+std::string writeJson(const JsonValue& value);
+
+/** \brief The output's vector_layers, merged from those of the inputs
+*
+* Layers are matched by id, so the same layer in several inputs is listed
+* once. It keeps what the first input said about it (e.g. its description),
+* except that it takes the lowest minzoom, the highest maxzoom and every
+* input's fields. A field the inputs give different types becomes "Mixed".
+*/
+class VectorLayers {
+	std::map<std::string, JsonValue> layers;
+
+public:
+	/// Merge in an input's vector_layers array. Throws std::runtime_error if
+	/// it isn't one.
+	void add(const JsonValue& vectorLayers);
+
+	/// The merged array, ordered by id.
+	std::string toJson() const;
+};
+
+#endif //_JSON_H
@@ -0,0 +1,42 @@
+/*! \file */
+#ifndef _LAYER_FILTER_H
+#define _LAYER_FILTER_H
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "json.h"
+
+/** \brief Which of an input's layers to keep, and what to call them
+*
+* A layer is kept if it matches one of the include globs (or there are none)
+* and none of the exclude globs. A kept layer whose name is in the rename map
+* takes its new name. Globs are as for fnmatch(3), e.g. "debug_*".
+*
+* Tiles are filtered without decoding their features: only each layer's
+* name is read, dropped layers are skipped, and a renamed layer is copied
+* with just its name field rewritten. A layer renamed to the name of another
+* layer in the same tile is combined with it, as by mergeTileLayers.
+*/
+class LayerFilter {
+public:
+	std::vector<std::string> includes;
+	std::vector<std::string> excludes;
+	std::vector<std::pair<std::string, std::string>> renames;
+
+	bool empty() const { return includes.empty() && excludes.empty() && renames.empty(); }
+
+	/// Whether a layer is kept, and if so, what it's called in the output.
+	bool apply(const std::string& name, std::string& renamed) const;
+
+	/// Filter a decompressed tile into `output`. Returns false, leaving
+	/// `output` alone, if no layer is dropped or renamed. Throws
+	/// std::runtime_error if layers a rename combines have different extents.
+	bool filterTile(const std::string& tile, std::string& output) const;
+
+	/// Filter a list of layers from an input's metadata, e.g. vector_layers
+	/// (whose entries are named by "id") or tilestats' layers ("layer").
+	void filterLayerList(JsonValue& layers, const char* nameKey) const;
+};
+
+#endif //_LAYER_FILTER_H
@@ -0,0 +1,40 @@
+/*! \file */
+#ifndef _LAYER_MERGE_H
+#define _LAYER_MERGE_H
+
+#include <string>
+#include <vector>
+#include <vtzero/vector_tile.hpp>
+
+/// Append the layers of each of `tiles`, in order, to `layers`.
+void readTileLayers(const std::vector<std::string>& tiles, std::vector<vtzero::layer>& layers);
+
+/** \brief Drop duplicate layers from a multi-source tile
+*
+* A layer that's byte-for-byte the same as an earlier one, name included, is
+* dropped: each layer's bytes are hashed, and only layers with the same hash
+* are compared. With `firstWins`, any layer with the same name as an earlier
+* one is dropped too, so the first input to have a layer is the only one
+* that contributes it. Neither decodes any features.
+*
+* Returns the number of layers dropped.
+*/
+size_t dropDuplicateLayers(std::vector<vtzero::layer>& layers, bool firstWins);
+
+/** \brief Merge layers that may share names into a tile
+*
+* Layers whose names are unique are copied as-is. Layers with the same name
+* are combined into one, which has all of their features: keys and values
+* are added to the new layer's tables once each, and each feature's id and
+* geometry are copied without decoding them.
+*
+* Layers can only be combined if they have the same extent, since their
+* geometries would otherwise need rescaling; if they don't, this throws
+* std::runtime_error. The combined layer has the highest of their versions.
+*
+* Returns false, leaving `output` alone, if no two layers share a name, as
+* they can then just be concatenated.
+*/
+bool mergeTileLayers(std::vector<vtzero::layer>& layers, std::string& output);
+
+#endif //_LAYER_MERGE_H
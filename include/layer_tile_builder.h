@@ -0,0 +1,44 @@
+/*! \file */
+#ifndef _LAYER_TILE_BUILDER_H
+#define _LAYER_TILE_BUILDER_H
+
+#include <memory>
+#include <vector>
+#include <vtzero/builder.hpp>
+
+/** \brief A vtzero::tile_builder for tiles made only of existing layers
+*
+* vtzero's tile_builder heap-allocates a layer_builder_impl for every layer
+* it's given, with the strings and maps it'd need to build a new layer, even
+* when the layer is just copied. Merging only ever copies, so this keeps
+* each layer's bytes as a data_view, in a vector whose allocator the caller
+* picks (an ArenaAllocator in the merge stage). serialize() writes the same
+* bytes vtzero would, and sizes the buffer exactly rather than estimating.
+*/
+template <typename TAllocator = std::allocator<vtzero::data_view>>
+class LayerTileBuilder {
+	std::vector<vtzero::data_view, TAllocator> layers;
+
+public:
+	explicit LayerTileBuilder(const TAllocator& allocator = TAllocator()): layers(allocator) {}
+
+	void add_existing_layer(const vtzero::layer& layer) {
+		layers.push_back(layer.data());
+	}
+
+	/// Append the tile to `buffer`, which may be a std::string or any other
+	/// buffer protozero supports.
+	template <typename TBuffer>
+	void serialize(TBuffer& buffer) const {
+		size_t size = 0;
+		for (const auto& layer : layers)
+			size += 1 + protozero::length_of_varint(layer.size()) + layer.size();
+
+		protozero::basic_pbf_builder<TBuffer, vtzero::detail::pbf_tile> pbf{buffer};
+		pbf.reserve(size);
+		for (const auto& layer : layers)
+			pbf.add_bytes(vtzero::detail::pbf_tile::layers, layer);
+	}
+};
+
+#endif //_LAYER_TILE_BUILDER_H
@@ -2,10 +2,14 @@
 #ifndef _MBTILES_H
 #define _MBTILES_H
 
+#include <memory>
 #include <string>
 #include <vector>
 #include "external/sqlite_modern_cpp.h"
+#include "sqlite_btree.h"
 #include "tile_coordinates_set.h"
+#include "tile_source.h"
+#include "tile_sink.h"
 
 struct PendingStatement {
 	int zoom;
@@ -24,35 +28,50 @@ private:
 	int fd_;
 };
 
+/// How to tune the SQLite connection of an MBTiles input. The defaults leave
+/// SQLite's own settings alone.
+struct MBTilesReadOptions {
+	bool mmap = false;          ///< Memory-map the whole file (PRAGMA mmap_size)
+	int64_t cacheKiB = 0;       ///< Page cache size (PRAGMA cache_size), or 0 for SQLite's default
+	bool readAhead = false;     ///< Ask the kernel to start reading the whole file into the page cache
+	bool directBtree = false;   ///< Read tiles by walking the B-tree pages ourselves (see SqliteBtreeReader)
+};
+
 /** \brief Write to MBTiles (sqlite) database
 *
 * (note that sqlite_modern_cpp.h is very slightly changed from the original, for blob support and an .init method)
 */
-class MBTiles { 
+class MBTiles : public TileSource, public TileSink {
 	sqlite::database db;
 	std::vector<sqlite::database_binder> preparedStatements;
 	int lockfd;
 	bool inTransaction;
 	std::string filename;
+	MBTilesReadOptions readOptions;
+	std::unique_ptr<SqliteBtreeReader> btree;
 
 	std::shared_ptr<std::vector<PendingStatement>> pendingStatements1, pendingStatements2;
+	uint64_t pendingBytes;
 
 	void insertOrReplace(int zoom, int x, int y, const std::string& data, bool isMerge);
 	void flushPendingStatements();
+	void openBtree();
 
 public:
-	MBTiles();
+	MBTiles(const MBTilesReadOptions& readOptions = MBTilesReadOptions());
 	virtual ~MBTiles();
-	void openForWriting(std::string &filename);
-	void writeMetadata(std::string key, std::string value);
-	std::vector<std::pair<std::string, std::string>> readMetadata();
-	void saveTile(int zoom, int x, int y, std::string *data, bool isMerge);
-	void closeForWriting();
-
-	void populateTiles(bool verbose, std::vector<PreciseTileCoordinatesSet>& zooms, std::vector<Bbox>& extents);
-	void openForReading(std::string &filename);
-	void readBoundingBox(double &minLon, double &maxLon, double &minLat, double &maxLat);
-	std::vector<char> readTile(int zoom, int col, int row);
+	void openForWriting(std::string &filename) override;
+	void writeMetadata(std::string key, std::string value) override;
+	std::vector<std::pair<std::string, std::string>> readMetadata() override;
+	void saveTile(int zoom, int x, int y, std::string *data, bool isMerge) override;
+	void closeForWriting() override;
+
+	void populateTiles(bool verbose, std::vector<PreciseTileCoordinatesSet>& zooms, std::vector<Bbox>& extents) override;
+	void openForReading(std::string &filename) override;
+	void readBoundingBox(double &minLon, double &maxLon, double &minLat, double &maxLat) override;
+	protozero::data_view readTile(int zoom, int col, int row, std::vector<char>& buffer) override;
+
+	std::vector<std::pair<std::string, int64_t>> ioCounters() override;
 };
 
 #endif //_MBTILES_H
@@ -0,0 +1,77 @@
+/*! \file */
+#ifndef _MEMORY_BUDGET_H
+#define _MEMORY_BUDGET_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+/** \brief A process-wide budget for the bytes of tile data held in memory
+*
+* Two kinds of bytes are charged against it:
+*
+* - The tiles in flight through the pipeline. The reader acquire()s a tile's
+*   compressed bytes before passing it on, and blocks while the budget is
+*   spent; the stages after it charge() what they allocate without blocking
+*   and release() it as they free it.
+* - The tiles an output has buffered but not yet written. Outputs charge
+*   those with chargeBuffered(), and flush early when shouldFlush() says so,
+*   so that the reader isn't kept waiting on bytes that nothing will release.
+*   An input that has to hold all of its tiles (a stream on stdin) charges
+*   them the same way.
+*
+* The reader only waits while other tiles are in flight, since those always
+* drain, so a single tile larger than the whole budget is still let through.
+* Without a limit nothing ever blocks and only the peak is tracked.
+*/
+class MemoryBudget {
+	uint64_t limit;
+	std::atomic<int64_t> inFlight;
+	std::atomic<int64_t> buffered;
+	std::atomic<int64_t> peak;
+	std::atomic<uint64_t> waits;
+
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::atomic<int> waiters;
+	std::atomic<bool> cancelled;
+
+	void notePeak();
+
+public:
+	MemoryBudget();
+
+	/// 0 means unlimited. Set it before starting any threads.
+	void setLimit(uint64_t bytes) { limit = bytes; }
+	uint64_t getLimit() const { return limit; }
+
+	/// Wait until `bytes` fit in the budget (or nothing else is in flight),
+	/// then charge them. `held` is what the caller already has in flight,
+	/// which it mustn't wait for itself.
+	void acquire(uint64_t bytes, uint64_t held = 0);
+	void charge(int64_t bytes);
+	void release(int64_t bytes);
+
+	/// Stop anyone waiting in acquire(), e.g. when the stages that would
+	/// release memory have failed.
+	void cancel();
+
+	void chargeBuffered(int64_t bytes);
+	void releaseBuffered(int64_t bytes);
+
+	/// Whether an output holding `bufferedBytes` should flush them now: when
+	/// they're more than a quarter of the budget, or the budget is spent and
+	/// they're a noticeable part of it.
+	bool shouldFlush(uint64_t bufferedBytes) const {
+		return limit > 0 && (bufferedBytes > limit / 4 ||
+			(bufferedBytes > limit / 16 && (uint64_t)(inFlight + buffered) >= limit));
+	}
+
+	uint64_t getPeak() const { return peak; }
+	uint64_t getWaits() const { return waits; }
+};
+
+extern MemoryBudget memoryBudget;
+
+#endif //_MEMORY_BUDGET_H
@@ -0,0 +1,47 @@
+/*! \file */
+#ifndef _NUMA_H
+#define _NUMA_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// A NUMA node that has CPUs, as described in /sys/devices/system/node.
+struct NumaNode {
+	int id;
+	std::vector<int> cpus;
+};
+
+/// Parse a sysfs CPU list like "0-7,16-23".
+std::vector<int> parseCpuList(const std::string& list);
+
+/// The nodes that have CPUs, in order of id. Empty if sysfs doesn't describe
+/// any, in which case callers should behave as if there's just one.
+std::vector<NumaNode> readNumaTopology();
+
+/// Run this thread, and every thread it starts afterwards, on a node's CPUs,
+/// and prefer that node's memory for their allocations. Returns false if the
+/// kernel refused either, or off Linux, where it does nothing.
+bool bindToNumaNode(const NumaNode& node);
+
+/** \brief Which shard writes a tile
+*
+* Tiles are normally dealt out to shards round-robin. With more than one
+* node, shard s runs on node s % nodes, and blocks of columns are first dealt
+* out to nodes, so that each node's shards read (and fault into that node's
+* memory) contiguous stretches of the inputs, then round-robin between the
+* shards on the node.
+*/
+uint64_t tileShard(int zoom, int x, int y, uint64_t shards, uint64_t nodes);
+
+/// Each node's allocation counters from its numastat (numa_hit, local_node,
+/// other_node, ...). They're system-wide: the kernel doesn't keep them per
+/// process.
+std::vector<std::pair<std::string, int64_t>> readNumaCounters();
+
+/// How many bytes of this process's memory are on each node, from
+/// /proc/self/numa_maps.
+std::vector<std::pair<std::string, int64_t>> readNumaPages();
+
+#endif //_NUMA_H
@@ -0,0 +1,66 @@
+/*! \file */
+#ifndef _PMTILES_H
+#define _PMTILES_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "tile_source.h"
+
+// See https://github.com/protomaps/PMTiles/blob/main/spec/v3/spec.md
+#define PMTILES_HEADER_SIZE 127
+
+#define PMTILES_COMPRESSION_UNKNOWN 0
+#define PMTILES_COMPRESSION_NONE 1
+#define PMTILES_COMPRESSION_GZIP 2
+
+/** \brief Read tiles from a PMTiles v3 archive
+*
+* The archive is mmapped. All directories (root and leaves) are decoded once,
+* when the archive is opened, into a sorted index of tile ID runs. Tile reads
+* are a binary search in that index and return a view into the mapping.
+* With readAhead, the kernel is asked to start paging the whole archive in.
+*/
+class PMTiles : public TileSource {
+	struct Entry {
+		uint64_t tileId;
+		uint64_t offset; // absolute offset in the archive
+		uint32_t length;
+		uint32_t runLength;
+	};
+
+	std::string filename;
+	bool readAhead;
+	int fd;
+	const char* data;
+	size_t size;
+
+	uint8_t tileCompression;
+	uint8_t minZoom, maxZoom;
+	double minLon, minLat, maxLon, maxLat;
+	uint64_t metadataOffset, metadataLength;
+	uint64_t leafDirsOffset, leafDirsLength;
+	uint64_t tileDataOffset;
+	uint8_t internalCompression;
+
+	std::vector<Entry> entries;
+
+	void readDirectory(uint64_t offset, uint64_t length, int depth);
+	std::string readSection(uint64_t offset, uint64_t length);
+
+public:
+	PMTiles(bool readAhead = false);
+	virtual ~PMTiles();
+
+	void openForReading(std::string &filename) override;
+	std::vector<std::pair<std::string, std::string>> readMetadata() override;
+	void readBoundingBox(double &minLon, double &maxLon, double &minLat, double &maxLat) override;
+	void populateTiles(bool verbose, std::vector<PreciseTileCoordinatesSet>& zooms, std::vector<Bbox>& extents) override;
+	protozero::data_view readTile(int zoom, int col, int row, std::vector<char>& buffer) override;
+};
+
+// Hilbert tile IDs, as used by PMTiles. y is in the XYZ convention.
+uint64_t zxyToTileId(uint8_t z, uint32_t x, uint32_t y);
+void tileIdToZxy(uint64_t tileId, uint8_t &z, uint32_t &x, uint32_t &y);
+
+#endif //_PMTILES_H
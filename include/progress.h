@@ -0,0 +1,54 @@
+/*! \file */
+#ifndef _PROGRESS_H
+#define _PROGRESS_H
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <string>
+
+/** \brief Periodic progress lines with throughput and ETA
+*
+* Each shard is a separate process, so when sharded every shard writes its
+* counters to ./progress.<shard>, and the lowest-numbered shard that's still
+* running adds them all up for the lines it prints. Status files written
+* before this run started are ignored.
+*/
+class Progress {
+	uint64_t shards;
+	uint64_t shard;
+	double interval;
+
+	std::chrono::steady_clock::time_point start;
+	std::chrono::steady_clock::time_point nextReport;
+	time_t startTime;
+
+	int zoom;
+	uint64_t planned;
+	uint64_t done;
+	uint64_t bytesOut;
+	bool finished;
+
+	void report();
+	void writeStatus();
+	void print(int zoom, uint64_t planned, uint64_t done, double tilesPerSecond, double bytesPerSecond);
+
+public:
+	Progress(uint64_t shards, uint64_t shard, double interval);
+
+	void setPlanned(uint64_t tiles);
+	void setZoom(int zoom);
+
+	/// Count a tile written. The clock is only checked every so often.
+	void tileDone(uint64_t bytes) {
+		done++;
+		bytesOut += bytes;
+		if ((done & 63) == 0 && std::chrono::steady_clock::now() >= nextReport)
+			report();
+	}
+
+	/// Report the final numbers for this process.
+	void finish();
+};
+
+#endif //_PROGRESS_H
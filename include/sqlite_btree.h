@@ -0,0 +1,63 @@
+/*! \file */
+#ifndef _SQLITE_BTREE_H
+#define _SQLITE_BTREE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <protozero/data_view.hpp>
+
+/** \brief Read tiles straight out of an MBTiles file's B-tree pages
+*
+* The file is mmapped, and a tile is found by walking the index on
+* (zoom_level, tile_column, tile_row) to get its rowid, then the tiles table
+* to get its record, without going through SQLite's VM or pager. It only
+* works for files that don't change while they're open; see
+* https://www.sqlite.org/fileformat2.html for the format.
+*
+* The caller works out the root pages and column position from the schema
+* (SQLite is better at that). Anything unexpected in the pages themselves
+* throws, so that the caller can fall back to asking SQLite.
+*
+* Reading never modifies the reader, so it's safe from any number of threads.
+*/
+class SqliteBtreeReader {
+	struct Payload {
+		const uint8_t* local;
+		uint64_t localSize;
+		uint64_t totalSize;
+		uint32_t overflowPage;
+	};
+
+	std::string filename;
+	int fd;
+	const uint8_t* data;
+	size_t size;
+	uint32_t pageSize;
+	uint32_t usableSize;
+
+	uint32_t tilesRoot;
+	uint32_t indexRoot;
+	int tileDataColumn;
+
+	const uint8_t* page(uint32_t number) const;
+	Payload cellPayload(uint64_t totalSize, const uint8_t* local, const uint8_t* end, bool tableLeaf) const;
+	void compareIndexCell(const uint8_t* cell, const uint8_t* end, bool leaf, const int64_t* key, int& cmp, int64_t& rowid) const;
+	void copyPayload(const Payload& payload, uint64_t offset, uint64_t length, char* out) const;
+	bool findRowid(int64_t zoom, int64_t col, int64_t row, int64_t& rowid) const;
+	bool findRecord(int64_t rowid, Payload& payload) const;
+
+public:
+	SqliteBtreeReader();
+	~SqliteBtreeReader();
+
+	/// tileDataColumn is tile_data's position in the tiles table's records.
+	void open(const std::string& filename, uint32_t tilesRoot, uint32_t indexRoot, int tileDataColumn);
+
+	/// Find a tile. Returns false if there's no such tile. The view either
+	/// points into the mapping or, when the tile spills onto overflow pages,
+	/// into `buffer`.
+	bool readTile(int zoom, int col, int row, protozero::data_view& tile, std::vector<char>& buffer) const;
+};
+
+#endif //_SQLITE_BTREE_H
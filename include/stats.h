@@ -0,0 +1,162 @@
+/*! \file */
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// The stages a run's time is broken down into. Stages can nest: a flush
+/// includes the time spent waiting for the lock it takes.
+enum class Stage {
+	IndexBuild,
+	Read,
+	Decompress,
+	Merge,
+	Compress,
+	QueueWait,
+	Write,
+	Flush,
+	LockWait,
+	MemoryWait,
+	TileStats,
+	Filter,
+};
+
+#define STAGE_COUNT 12
+
+// Spans kept per thread when tracing; older spans are overwritten. The
+// buffer grows as spans are recorded, to at most 24 bytes a span.
+#define TRACE_BUFFER_EVENTS (1 << 20)
+
+/// Time spent in, and the number of times we entered, each stage on one thread.
+struct StageCounters {
+	uint64_t nanoseconds[STAGE_COUNT] = {};
+	uint64_t calls[STAGE_COUNT] = {};
+};
+
+// Each power of two is split into 2^HISTOGRAM_SUB_BUCKET_BITS buckets, so
+// recorded values are accurate to within about 6%.
+#define HISTOGRAM_SUB_BUCKET_BITS 4
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BUCKET_BITS + 1) << HISTOGRAM_SUB_BUCKET_BITS)
+
+/** \brief A log-linear (HDR-style) histogram of unsigned values
+*
+* Values below 2^HISTOGRAM_SUB_BUCKET_BITS are counted exactly; larger values
+* fall into buckets whose width is proportional to their magnitude.
+*/
+class Histogram {
+public:
+	Histogram();
+
+	void record(uint64_t value);
+	void merge(const Histogram& other);
+
+	uint64_t count() const { return count_; }
+	uint64_t max() const { return max_; }
+
+	/// The smallest value that at least fraction q of recorded values are at
+	/// or below, rounded up to the end of its bucket.
+	uint64_t percentile(double q) const;
+
+private:
+	std::vector<uint64_t> buckets;
+	uint64_t count_;
+	uint64_t max_;
+};
+
+/// Tiles and bytes that went through one zoom level.
+struct ZoomStats {
+	uint64_t singleSourceTiles = 0;
+	uint64_t multiSourceTiles = 0;
+	uint64_t bytesIn = 0;
+	uint64_t bytesOut = 0;
+
+	// Only recorded when stageTimingEnabled is set.
+	Histogram readNanoseconds;
+	Histogram mergeNanoseconds;
+	Histogram tileBytes;
+};
+
+/// Named I/O counters from one input, the output, or the process.
+struct IoCounters {
+	std::string name;
+	std::vector<std::pair<std::string, int64_t>> values;
+};
+
+/// How full one of the pipeline's queues was, sampled periodically.
+struct QueueStats {
+	std::string name;
+	uint64_t capacity = 0;
+	uint64_t samples = 0;
+	uint64_t occupancySum = 0;
+	uint64_t emptySamples = 0;
+	uint64_t fullSamples = 0;
+	Histogram occupancy;
+
+	// How often a producer found it full, or a consumer found it empty.
+	uint64_t blockedPushes = 0;
+	uint64_t blockedPops = 0;
+
+	void sample(uint64_t size) {
+		samples++;
+		occupancySum += size;
+		if (size == 0) emptySamples++;
+		if (size >= capacity) fullSamples++;
+		occupancy.record(size);
+	}
+};
+
+/// StageTimer does nothing unless one of these is set, so instrumented code
+/// costs a branch when neither --stats nor --trace is given. Set them before
+/// starting any threads.
+extern bool stageTimingEnabled;
+extern bool stageTracingEnabled;
+
+const char* stageName(Stage stage);
+
+/// This thread's counters. The first call on each thread registers them so
+/// that they're included in the report, even after the thread has exited.
+StageCounters& threadStageCounters();
+
+/** \brief Add the time between construction and destruction to a stage
+*
+* The duration is counted, and recorded in this thread's histogram for the
+* stage. When tracing, the span is also recorded in this thread's ring buffer of
+* trace events, which holds the most recent TRACE_BUFFER_EVENTS spans.
+*
+* Counters and trace buffers are per-thread and unsynchronised, so reports
+* must only be written once every instrumented thread has finished.
+*/
+class StageTimer {
+public:
+	/// If elapsed is given, the span's duration is also added to it.
+	StageTimer(Stage stage, uint64_t* elapsed = NULL);
+	~StageTimer();
+
+private:
+	Stage stage;
+	bool enabled;
+	uint64_t* elapsed;
+	std::chrono::steady_clock::time_point start;
+};
+
+/// Print percentiles of the per-zoom histograms and of each stage's durations.
+void printLatencyReport(const std::vector<ZoomStats>& zooms);
+
+void printIoReport(const std::vector<IoCounters>& io);
+
+/// Print each queue's mean and p99 occupancy, and how often it was empty or
+/// full. A stage whose input queue is usually full is the bottleneck.
+void printQueueReport(const std::vector<QueueStats>& queues);
+
+/// Write the --stats JSON report.
+void writeStatsReport(const std::string& filename, uint64_t shards, uint64_t shard, double wallSeconds, const std::vector<ZoomStats>& zooms, const std::vector<IoCounters>& io, const std::vector<QueueStats>& queues);
+
+/// Write the spans recorded for --trace in Chrome's trace event format.
+void writeTraceReport(const std::string& filename, uint64_t shard);
+
+#endif //_STATS_H
@@ -0,0 +1,39 @@
+/*! \file */
+#ifndef _TILE_BUDGET_H
+#define _TILE_BUDGET_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+/** \brief A limit on the size of each output tile
+*
+* A tile whose compressed size is over the limit loses layers, lowest
+* priority first, until it fits. The priority list names the layers to keep
+* longest, most important first; layers that aren't in it go before any that
+* are, the last of them in the tile first. The last layer left is never
+* dropped, even if the tile is still too big.
+*
+* Layers are length-delimited, so they're dropped by copying the others'
+* bytes. How many to drop is first estimated from their uncompressed sizes and
+* the tile's compression ratio, then corrected one layer at a time, since
+* some layers compress much better than others.
+*/
+class TileBudget {
+public:
+	size_t maxBytes = 0;
+	std::vector<std::string> priorities;
+
+	bool enabled() const { return maxBytes > 0; }
+
+	/// Compress `tile` into `output`, dropping layers until it fits. The
+	/// names of the layers dropped are appended to `dropped`. Returns false
+	/// if it's still too big.
+	bool fit(const std::string& tile, std::string& output, const std::function<std::string(const std::string&)>& compress, std::vector<std::string>& dropped) const;
+
+private:
+	// Where a layer comes in the order they're kept: the higher, the longer.
+	size_t rank(const std::string& name) const;
+};
+
+#endif //_TILE_BUDGET_H
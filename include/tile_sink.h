@@ -0,0 +1,27 @@
+/*! \file */
+#ifndef _TILE_SINK_H
+#define _TILE_SINK_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/** \brief Common interface for the outputs we can write merged tiles to (MBTiles, directories).
+*
+* As with TileSource, tile rows are in the MBTiles (TMS) convention.
+*/
+class TileSink {
+public:
+	virtual ~TileSink() {}
+
+	virtual void openForWriting(std::string &filename) = 0;
+	virtual void writeMetadata(std::string key, std::string value) = 0;
+	virtual void saveTile(int zoom, int x, int y, std::string *data, bool isMerge) = 0;
+	virtual void closeForWriting() = 0;
+
+	// As TileSource::ioCounters.
+	virtual std::vector<std::pair<std::string, int64_t>> ioCounters() { return {}; }
+};
+
+#endif //_TILE_SINK_H
@@ -0,0 +1,36 @@
+/*! \file */
+#ifndef _TILE_SOURCE_H
+#define _TILE_SOURCE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <protozero/data_view.hpp>
+#include "tile_coordinates_set.h"
+
+/** \brief Common interface for the inputs we can read tiles from (MBTiles, PMTiles).
+*
+* Tile coordinates are always in the MBTiles (TMS) convention, i.e. row 0 is
+* at the bottom. Sources that store XYZ tiles flip the row themselves.
+*/
+class TileSource {
+public:
+	virtual ~TileSource() {}
+
+	virtual void openForReading(std::string &filename) = 0;
+	virtual std::vector<std::pair<std::string, std::string>> readMetadata() = 0;
+	virtual void readBoundingBox(double &minLon, double &maxLon, double &minLat, double &maxLat) = 0;
+	virtual void populateTiles(bool verbose, std::vector<PreciseTileCoordinatesSet>& zooms, std::vector<Bbox>& extents) = 0;
+
+	// Returns the raw (still compressed) bytes of a tile. Sources that can hand
+	// out a view into their own storage do so; others copy the tile into
+	// `buffer` and return a view onto that. Either way, the view is only valid
+	// until the next readTile call on this source.
+	virtual protozero::data_view readTile(int zoom, int col, int row, std::vector<char>& buffer) = 0;
+
+	// Counters describing this source's I/O so far, such as SQLite page cache
+	// hits and misses. Sources with nothing to report return nothing.
+	virtual std::vector<std::pair<std::string, int64_t>> ioCounters() { return {}; }
+};
+
+#endif //_TILE_SOURCE_H
@@ -0,0 +1,72 @@
+/*! \file */
+#ifndef _TILE_STREAM_H
+#define _TILE_STREAM_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "tile_source.h"
+#include "tile_sink.h"
+
+// The filename that means "stdin" as an input, or "stdout" as the output.
+#define TILE_STREAM_FILENAME "-"
+
+/** \brief Read and write tiles as a stream of records on stdin/stdout
+*
+* Every record is a 13 byte header followed by a blob:
+*
+*   uint8   zoom (0xFF for a metadata record)
+*   uint32  x
+*   uint32  y (XYZ, i.e. row 0 is at the top)
+*   uint32  length of the blob
+*
+* All integers are little-endian. Tile blobs are the tile as it would be
+* stored in MBTiles (i.e. compressed). A metadata record's x and y are 0, and
+* its blob is the key, a NUL byte, then the value.
+*
+* There's no stream header, so the output of several shards can be
+* concatenated. Writers only ever write whole records, holding the same flock
+* as MBTiles, so shards can share one stdout.
+*
+* Reading needs random access, so the whole input stream is read into memory
+* up front; tiles are then served as views into it. Merging can't start until
+* the stream ends, and the bytes are charged to memoryBudget as buffered for
+* as long as the stream is open.
+*/
+class TileStream : public TileSource, public TileSink {
+	struct Entry {
+		uint64_t key; // zoom, x and TMS row packed together
+		uint64_t offset;
+		uint32_t length;
+	};
+
+	std::string filename;
+	int lockfd;
+
+	// Writing
+	std::string buffer;
+	void appendRecord(uint8_t zoom, uint32_t x, uint32_t y, const char* data, size_t size);
+	void flush();
+
+	// Reading
+	std::string data;
+	std::vector<Entry> entries;
+	std::vector<std::pair<std::string, std::string>> metadata;
+
+public:
+	TileStream();
+	virtual ~TileStream();
+
+	void openForWriting(std::string &filename) override;
+	void writeMetadata(std::string key, std::string value) override;
+	void saveTile(int zoom, int x, int y, std::string *data, bool isMerge) override;
+	void closeForWriting() override;
+
+	void openForReading(std::string &filename) override;
+	std::vector<std::pair<std::string, std::string>> readMetadata() override;
+	void readBoundingBox(double &minLon, double &maxLon, double &minLat, double &maxLat) override;
+	void populateTiles(bool verbose, std::vector<PreciseTileCoordinatesSet>& zooms, std::vector<Bbox>& extents) override;
+	protozero::data_view readTile(int zoom, int col, int row, std::vector<char>& buffer) override;
+};
+
+#endif //_TILE_STREAM_H
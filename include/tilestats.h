@@ -0,0 +1,102 @@
+/*! \file */
+#ifndef _TILESTATS_H
+#define _TILESTATS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+#include "json.h"
+
+/// The number of distinct values tracked per attribute. Past this, an
+/// attribute's count stops growing, but its min and max are still kept.
+#define TILESTATS_MAX_TRACKED_VALUES 1000
+/// The number of values written per attribute in the output, as in
+/// mapbox-geostats.
+#define TILESTATS_MAX_VALUES 100
+
+/// The values one attribute of one layer takes.
+struct AttributeStats {
+	std::set<std::string> strings;
+	std::set<double> numbers;
+	bool hasFalse = false;
+	bool hasTrue = false;
+	bool hasRange = false;
+	double min = 0;
+	double max = 0;
+	// What an input's own tilestats said: how many distinct values there
+	// were, which may be more than it listed, and their type.
+	uint64_t reportedCount = 0;
+	std::string reportedType;
+
+	size_t tracked() const { return strings.size() + numbers.size() + hasFalse + hasTrue; }
+	uint64_t count() const { return std::max<uint64_t>(tracked(), reportedCount); }
+	/// string, number, boolean or mixed.
+	std::string type() const;
+
+	void addString(const std::string& value);
+	void addNumber(double value);
+	void addBoolean(bool value);
+	void addRange(double min, double max);
+	void merge(const AttributeStats& other);
+};
+
+/// What's in one layer, across every tile it's in.
+struct LayerStats {
+	uint64_t features = 0;
+	// Features by vtzero::GeomType: unknown, point, linestring, polygon.
+	uint64_t geometries[4] = {};
+	std::map<std::string, AttributeStats> attributes;
+
+	void merge(const LayerStats& other);
+};
+
+/** \brief Tilestats, as in mapbox-geostats, built up from the tiles themselves
+*
+* Each merge thread scans the tiles it sees into its own TileStats, and
+* they're merged at the end. Features are counted per tile, so one that
+* spans several tiles or zooms counts once for each. Inputs that bring their
+* own tilestats can be merged in with addJson() instead of being scanned.
+*/
+class TileStats {
+public:
+	std::map<std::string, LayerStats> layers;
+
+	/// Scan a decompressed vector tile. Each distinct key/value pair in a
+	/// layer is decoded once, however many features use it.
+	void addTile(const std::string& tile);
+
+	void merge(const TileStats& other);
+
+	/// Merge in a `tilestats` object, as produced by toJson() or by other
+	/// tools. Throws std::runtime_error if it isn't one.
+	void addJson(const JsonValue& tilestats);
+
+	/// The `tilestats` object, listing up to `maxValues` values for each
+	/// attribute.
+	std::string toJson(size_t maxValues = TILESTATS_MAX_VALUES) const;
+};
+
+/** \brief Combine the tilestats of every shard, once they've all finished
+*
+* Shards are separate processes, so each writes what it scanned to
+* tilestats.<shard> in the working directory, like the progress files. The
+* shard that finishes last finds every shard's file, merges them into
+* `total`, removes them and returns true; the others return false.
+*
+* Each file starts with `run`, which identifies the run, so files left
+* behind by one that failed don't count. If every shard has a file but some
+* are from another run, the shards started with different run ids or one is
+* yet to start: rather than leave the output without metadata, this merges
+* the files that match, returns true and lists the others in `otherRuns`.
+* The files are kept then, so a later shard can still combine them all.
+*/
+bool combineShardTileStats(uint64_t shards, uint64_t shard, const std::string& run, const TileStats& own, TileStats& total, std::vector<uint64_t>& otherRuns);
+
+/// Remove a shard's tilestats file left behind by an earlier run.
+void clearShardTileStats(uint64_t shard);
+
+#endif //_TILESTATS_H
@@ -0,0 +1,467 @@
+#include "directory_tiles.h"
+#include "coordinates.h"
+#include "helpers.h"
+#include "json.h"
+#include "stats.h"
+#include "memory_budget.h"
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#else
+#include <dirent.h>
+#endif
+
+using namespace std;
+
+// Each writer thread will buffer at most this many tiles before saveTile blocks.
+#define DIRECTORY_WRITER_QUEUE_SIZE 1000
+
+#ifdef __linux__
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+#endif
+
+// Call fn for every entry in the directory open at dirfd.
+//
+// On Linux, this goes straight to getdents64 with a large buffer, which is
+// noticeably cheaper than readdir for the very wide z14 directories.
+static void listDirectory(int dirfd, const std::function<void(const char*)>& fn) {
+#ifdef __linux__
+	char buf[65536];
+	lseek(dirfd, 0, SEEK_SET);
+	while (true) {
+		long n = syscall(SYS_getdents64, dirfd, buf, sizeof(buf));
+		if (n < 0)
+			throw std::runtime_error(std::string("getdents64 failed: ") + strerror(errno));
+		if (n == 0)
+			break;
+
+		for (long pos = 0; pos < n; ) {
+			const linux_dirent64* entry = (const linux_dirent64*)(buf + pos);
+			fn(entry->d_name);
+			pos += entry->d_reclen;
+		}
+	}
+#else
+	DIR* dir = fdopendir(dup(dirfd));
+	if (!dir)
+		throw std::runtime_error(std::string("fdopendir failed: ") + strerror(errno));
+	rewinddir(dir);
+	while (struct dirent* entry = readdir(dir))
+		fn(entry->d_name);
+	closedir(dir);
+#endif
+}
+
+// Parse a non-negative integer that makes up all of `name`, optionally
+// followed by `suffix`. Returns -1 if name isn't of that form.
+static long parseNumericName(const char* name, const char* suffix) {
+	if (!isdigit(*name))
+		return -1;
+
+	char* end;
+	long rv = strtol(name, &end, 10);
+	if (strcmp(end, suffix) != 0)
+		return -1;
+
+	return rv;
+}
+
+static int openDirectory(int dirfd, const std::string& name, bool create) {
+	if (create && mkdirat(dirfd, name.c_str(), 0755) != 0 && errno != EEXIST)
+		throw std::runtime_error("unable to create directory " + name + ": " + strerror(errno));
+
+	int fd = openat(dirfd, name.c_str(), O_RDONLY | O_DIRECTORY);
+	if (fd == -1)
+		throw std::runtime_error("unable to open directory " + name + ": " + strerror(errno));
+
+	return fd;
+}
+
+static std::string readFile(int dirfd, const std::string& name) {
+	std::string rv;
+	int fd = openat(dirfd, name.c_str(), O_RDONLY);
+	if (fd == -1)
+		return rv;
+
+	char buf[8192];
+	ssize_t n;
+	while ((n = read(fd, buf, sizeof(buf))) > 0)
+		rv.append(buf, n);
+
+	close(fd);
+	return rv;
+}
+
+// metadata.json is a flat object whose values are (almost always) strings.
+// String values are unescaped; anything else is kept as its JSON text.
+static std::vector<std::pair<std::string, std::string>> parseMetadataJson(const std::string& json) {
+	JsonValue metadata = parseJson(json);
+	if (metadata.type != JsonValue::Type::Object)
+		throw std::runtime_error("metadata.json is not a JSON object");
+
+	std::vector<std::pair<std::string, std::string>> rv;
+	for (const auto& member : metadata.object)
+		rv.push_back(std::make_pair(member.first, member.second.type == JsonValue::Type::String ? member.second.string : writeJson(member.second)));
+	return rv;
+}
+
+DirectoryTiles::DirectoryTiles(unsigned int threads):
+	rootfd(-1),
+	threads(std::max(threads, 1u)),
+	failed(false),
+	minZoom(-1),
+	maxZoom(-1)
+{
+}
+
+DirectoryTiles::~DirectoryTiles() {
+	for (auto& writer : writers) {
+		{
+			std::lock_guard<std::mutex> lock(writer->mutex);
+			writer->closing = true;
+		}
+		writer->cv.notify_all();
+		if (writer->thread.joinable())
+			writer->thread.join();
+	}
+
+	if (rootfd != -1)
+		close(rootfd);
+}
+
+// ---- Write directory
+
+void DirectoryTiles::openForWriting(string &filename) {
+	this->filename = filename;
+
+	if (mkdir(filename.c_str(), 0755) != 0 && errno != EEXIST)
+		throw std::runtime_error("unable to create directory " + filename + ": " + strerror(errno));
+
+	rootfd = open(filename.c_str(), O_RDONLY | O_DIRECTORY);
+	if (rootfd == -1)
+		throw std::runtime_error("unable to open directory " + filename + ": " + strerror(errno));
+
+	for (unsigned int i = 0; i < threads; i++) {
+		writers.push_back(std::unique_ptr<Writer>(new Writer()));
+		Writer& writer = *writers.back();
+		writer.thread = std::thread([this, &writer]() { writeTiles(writer); });
+	}
+}
+
+void DirectoryTiles::writeMetadata(string key, string value) {
+	metadata[key] = value;
+}
+
+void DirectoryTiles::saveTile(int zoom, int x, int y, string *data, bool isMerge) {
+	// Route by column, so that a column's directory is only ever touched by
+	// one writer.
+	Writer& writer = *writers[(x + zoom) % writers.size()];
+
+	{
+		StageTimer timer(Stage::QueueWait);
+		std::unique_lock<std::mutex> lock(writer.mutex);
+		writer.cv.wait(lock, [&]() { return writer.queue.size() < DIRECTORY_WRITER_QUEUE_SIZE; });
+		// Charge before the writer thread can see the tile and release it.
+		memoryBudget.chargeBuffered(data->size());
+		writer.queue.push_back({zoom, x, y, *data, isMerge});
+	}
+	writer.cv.notify_all();
+}
+
+void DirectoryTiles::writeFile(int dirfd, const std::string& name, const char* data, size_t size) {
+	int fd = openat(dirfd, name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1)
+		throw std::runtime_error("unable to create " + name + ": " + strerror(errno));
+
+	while (size > 0) {
+		ssize_t n = write(fd, data, size);
+		if (n < 0) {
+			close(fd);
+			throw std::runtime_error("unable to write " + name + ": " + strerror(errno));
+		}
+		data += n;
+		size -= n;
+	}
+
+	close(fd);
+}
+
+void DirectoryTiles::writeTiles(Writer& writer) {
+	std::vector<int> zoomfds;
+	int columnfd = -1;
+	int columnZoom = -1;
+	int columnX = -1;
+
+	while (true) {
+		PendingStatement stmt;
+		{
+			std::unique_lock<std::mutex> lock(writer.mutex);
+			writer.cv.wait(lock, [&]() { return !writer.queue.empty() || writer.closing; });
+			if (writer.queue.empty())
+				break;
+
+			stmt = std::move(writer.queue.front());
+			writer.queue.pop_front();
+		}
+		writer.cv.notify_all();
+
+		// After a failure, keep draining the queue so that saveTile doesn't
+		// block; closeForWriting will report the error.
+		if (failed) {
+			memoryBudget.releaseBuffered(stmt.data.size());
+			continue;
+		}
+
+		try {
+			StageTimer timer(Stage::Write);
+			if (stmt.zoom != columnZoom || stmt.x != columnX) {
+				if (stmt.zoom >= zoomfds.size())
+					zoomfds.resize(stmt.zoom + 1, -1);
+				if (zoomfds[stmt.zoom] == -1)
+					zoomfds[stmt.zoom] = openDirectory(rootfd, std::to_string(stmt.zoom), true);
+
+				if (columnfd != -1)
+					close(columnfd);
+				columnfd = -1;
+				columnfd = openDirectory(zoomfds[stmt.zoom], std::to_string(stmt.x), true);
+				columnZoom = stmt.zoom;
+				columnX = stmt.x;
+			}
+
+			// On disk, y is XYZ.
+			int y = (1 << stmt.zoom) - 1 - stmt.y;
+			writeFile(columnfd, std::to_string(y) + ".pbf", stmt.data.data(), stmt.data.size());
+		} catch (std::exception& e) {
+			std::lock_guard<std::mutex> lock(errorMutex);
+			if (!error)
+				error = std::current_exception();
+			failed = true;
+		}
+		memoryBudget.releaseBuffered(stmt.data.size());
+	}
+
+	if (columnfd != -1)
+		close(columnfd);
+	for (int fd : zoomfds)
+		if (fd != -1)
+			close(fd);
+}
+
+void DirectoryTiles::closeForWriting() {
+	for (auto& writer : writers) {
+		{
+			std::lock_guard<std::mutex> lock(writer->mutex);
+			writer->closing = true;
+		}
+		writer->cv.notify_all();
+		writer->thread.join();
+	}
+	writers.clear();
+
+	if (error)
+		std::rethrow_exception(error);
+
+	if (!metadata.empty()) {
+		std::string json = "{";
+		for (const auto& entry : metadata) {
+			if (json.size() > 1)
+				json += ",";
+			json += escapeJsonString(entry.first) + ":" + escapeJsonString(entry.second);
+		}
+		json += "}\n";
+		writeFile(rootfd, "metadata.json", json.data(), json.size());
+	}
+}
+
+// ---- Read directory
+
+void DirectoryTiles::openForReading(string &filename) {
+	this->filename = filename;
+
+	rootfd = open(filename.c_str(), O_RDONLY | O_DIRECTORY);
+	if (rootfd == -1)
+		throw std::runtime_error("unable to open directory " + filename + ": " + strerror(errno));
+}
+
+std::vector<std::pair<std::string, std::string>> DirectoryTiles::readMetadata() {
+	std::vector<std::pair<std::string, std::string>> rv;
+	std::string json = readFile(rootfd, "metadata.json");
+	if (!json.empty())
+		rv = parseMetadataJson(json);
+
+	// Fall back to the zooms that are actually present in the tree.
+	bool hasMinZoom = false, hasMaxZoom = false;
+	for (const auto& entry : rv) {
+		if (entry.first == "minzoom") hasMinZoom = true;
+		if (entry.first == "maxzoom") hasMaxZoom = true;
+	}
+	if (!hasMinZoom && minZoom != -1)
+		rv.push_back(std::make_pair("minzoom", std::to_string(minZoom)));
+	if (!hasMaxZoom && maxZoom != -1)
+		rv.push_back(std::make_pair("maxzoom", std::to_string(maxZoom)));
+
+	return rv;
+}
+
+void DirectoryTiles::readBoundingBox(double &minLon, double &maxLon, double &minLat, double &maxLat) {
+	for (auto& entry : readMetadata()) {
+		if (entry.first != "bounds")
+			continue;
+
+		vector<string> b = split_string(entry.second, ',');
+		minLon = stod(b[0]); minLat = stod(b[1]);
+		maxLon = stod(b[2]); maxLat = stod(b[3]);
+		return;
+	}
+
+	// No bounds in the metadata, so derive them from the deepest zoom's tiles.
+	if (maxZoom == -1) {
+		minLon = -180; maxLon = 180;
+		minLat = MinLat; maxLat = MaxLat;
+		return;
+	}
+
+	minLon = tilex2lon(maxZoomExtent.minX, maxZoom);
+	maxLon = tilex2lon(maxZoomExtent.maxX + 1, maxZoom);
+	maxLat = tiley2lat(maxZoomExtent.minY, maxZoom);
+	minLat = tiley2lat(maxZoomExtent.maxY + 1, maxZoom);
+}
+
+void DirectoryTiles::populateTiles(bool verbose, std::vector<PreciseTileCoordinatesSet>& zooms, std::vector<Bbox>& extents) {
+	struct Tile {
+		int zoom;
+		uint32_t x;
+		uint32_t y;
+	};
+
+	// Find every z/x directory up front, then list the columns in parallel.
+	std::vector<std::pair<int, uint32_t>> columns;
+	listDirectory(rootfd, [&](const char* name) {
+		long zoom = parseNumericName(name, "");
+		if (zoom < 0 || zoom >= zooms.size())
+			return;
+
+		int zoomfd = openat(rootfd, name, O_RDONLY | O_DIRECTORY);
+		if (zoomfd == -1)
+			return;
+
+		listDirectory(zoomfd, [&](const char* name) {
+			long x = parseNumericName(name, "");
+			if (x >= 0 && x < (1l << zoom))
+				columns.push_back(std::make_pair((int)zoom, (uint32_t)x));
+		});
+		close(zoomfd);
+	});
+
+	std::atomic<size_t> nextColumn(0);
+	std::vector<std::vector<Tile>> found(threads);
+	std::vector<std::thread> workers;
+	std::mutex errorMutex;
+	std::exception_ptr error;
+	for (unsigned int i = 0; i < threads; i++) {
+		workers.push_back(std::thread([&, i]() {
+			try {
+				size_t column;
+				while ((column = nextColumn++) < columns.size()) {
+					int zoom = columns[column].first;
+					uint32_t x = columns[column].second;
+					int fd = openDirectory(rootfd, std::to_string(zoom) + "/" + std::to_string(x), false);
+					listDirectory(fd, [&](const char* name) {
+						long y = parseNumericName(name, ".pbf");
+						if (y >= 0 && y < (1l << zoom))
+							found[i].push_back({zoom, x, (uint32_t)y});
+					});
+					close(fd);
+				}
+			} catch (std::exception& e) {
+				std::lock_guard<std::mutex> lock(errorMutex);
+				if (!error)
+					error = std::current_exception();
+			}
+		}));
+	}
+	for (auto& worker : workers)
+		worker.join();
+
+	if (error)
+		std::rethrow_exception(error);
+
+	size_t tiles = 0;
+	maxZoomExtent = {
+		std::numeric_limits<size_t>::max(),
+		std::numeric_limits<size_t>::max(),
+		std::numeric_limits<size_t>::min(),
+		std::numeric_limits<size_t>::min()
+	};
+	for (const auto& list : found) {
+		for (const auto& tile : list) {
+			tiles++;
+			if (minZoom == -1 || tile.zoom < minZoom)
+				minZoom = tile.zoom;
+			if (tile.zoom > maxZoom) {
+				maxZoom = tile.zoom;
+				maxZoomExtent = { tile.x, tile.y, tile.x, tile.y };
+			}
+			if (tile.zoom == maxZoom) {
+				if (tile.x > maxZoomExtent.maxX) maxZoomExtent.maxX = tile.x;
+				if (tile.x < maxZoomExtent.minX) maxZoomExtent.minX = tile.x;
+				if (tile.y > maxZoomExtent.maxY) maxZoomExtent.maxY = tile.y;
+				if (tile.y < maxZoomExtent.minY) maxZoomExtent.minY = tile.y;
+			}
+
+			int z = tile.zoom;
+			uint32_t row = (1 << z) - 1 - tile.y;
+			zooms[z].set(tile.x, row);
+
+			if (tile.x > extents[z].maxX) extents[z].maxX = tile.x;
+			if (tile.x < extents[z].minX) extents[z].minX = tile.x;
+			if (row > extents[z].maxY) extents[z].maxY = row;
+			if (row < extents[z].minY) extents[z].minY = row;
+		}
+	}
+
+	if (verbose)
+		std::cout << filename << " had " << std::to_string(tiles) << " tiles" << std::endl;
+}
+
+protozero::data_view DirectoryTiles::readTile(int zoom, int col, int row, std::vector<char>& buffer) {
+	std::string path = std::to_string(zoom) + "/" + std::to_string(col) + "/" + std::to_string((1 << zoom) - 1 - row) + ".pbf";
+	int fd = openat(rootfd, path.c_str(), O_RDONLY);
+	if (fd == -1)
+		return {};
+
+	struct stat statBuf;
+	if (fstat(fd, &statBuf) != 0) {
+		close(fd);
+		throw std::runtime_error("unable to stat " + filename + "/" + path);
+	}
+
+	buffer.resize(statBuf.st_size);
+	size_t done = 0;
+	while (done < buffer.size()) {
+		ssize_t n = pread(fd, buffer.data() + done, buffer.size() - done, done);
+		if (n <= 0) {
+			close(fd);
+			throw std::runtime_error("unable to read " + filename + "/" + path);
+		}
+		done += n;
+	}
+
+	close(fd);
+	return { buffer.data(), buffer.size() };
+}
@@ -5,9 +5,13 @@
 #include <iomanip>
 #include <sstream>
 #include <cstring>
+#include <cstdio>
+#include <fstream>
 
 #include <sys/stat.h>
+#include <time.h>
 #include "helpers.h"
+#include "arena.h"
 #include "external/libdeflate/libdeflate.h"
 
 #ifdef _MSC_VER
@@ -73,6 +77,11 @@ public:
 thread_local Compressor compressor(9);
 thread_local Decompressor decompressor;
 
+// (De)compression happens in a scratch buffer the size of the worst case,
+// then just the result is copied out, so each tile's output is allocated
+// once at its exact size. The scratch is reset for every tile.
+thread_local Arena scratch(1024 * 1024);
+
 std::string compress_string(const std::string& str,
                             int compressionlevel,
                             bool asGzip) {
@@ -82,27 +91,25 @@ std::string compress_string(const std::string& str,
 	if (compressionlevel != compressor.level)
 		compressor.setLevel(compressionlevel);
 
-	std::string rv;
+	scratch.reset();
 	if (asGzip) {
 		size_t maxSize = libdeflate_gzip_compress_bound(compressor.compressor, str.size());
-		rv.resize(maxSize);
+		char* buffer = static_cast<char*>(scratch.allocate(maxSize, 1));
 
-		//std::cout << "compressing str with level " << std::to_string(compressionlevel) << " size " << std::to_string(str.size()) << " maxSize=" << std::to_string(maxSize) << " rv.size()=" << std::to_string(rv.size()) << std::endl;
-		size_t compressedSize = libdeflate_gzip_compress(compressor.compressor, str.data(), str.size(), &rv[0], maxSize);
+		//std::cout << "compressing str with level " << std::to_string(compressionlevel) << " size " << std::to_string(str.size()) << " maxSize=" << std::to_string(maxSize) << std::endl;
+		size_t compressedSize = libdeflate_gzip_compress(compressor.compressor, str.data(), str.size(), buffer, maxSize);
 		if (compressedSize == 0)
 			throw std::runtime_error("libdeflate_gzip_compress failed");
-		rv.resize(compressedSize);
+		return std::string(buffer, compressedSize);
 	} else {
 		size_t maxSize = libdeflate_zlib_compress_bound(compressor.compressor, str.size());
-		rv.resize(maxSize);
+		char* buffer = static_cast<char*>(scratch.allocate(maxSize, 1));
 
-		size_t compressedSize = libdeflate_zlib_compress(compressor.compressor, str.data(), str.size(), &rv[0], maxSize);
+		size_t compressedSize = libdeflate_zlib_compress(compressor.compressor, str.data(), str.size(), buffer, maxSize);
 		if (compressedSize == 0)
 			throw std::runtime_error("libdeflate_zlib_compress failed");
-		rv.resize(compressedSize);
+		return std::string(buffer, compressedSize);
 	}
-
-	return rv;
 }
 
 // Decompress an STL string using zlib and return the original data.
@@ -111,10 +118,18 @@ std::string compress_string(const std::string& str,
 void decompress_string(std::string& output, const char* input, uint32_t inputSize, bool asGzip) {
 	size_t uncompressedSize;
 
-	if (output.size() < inputSize)
-		output.resize(inputSize);
+	// A gzip stream ends with its uncompressed size (mod 2^32), which saves
+	// guessing. Don't trust it past deflate's best possible ratio, though.
+	size_t capacity = std::max<size_t>(output.capacity(), (size_t)inputSize * 4);
+	if (asGzip && inputSize >= 18) {
+		const unsigned char* trailer = reinterpret_cast<const unsigned char*>(input) + inputSize - 4;
+		size_t size = trailer[0] | trailer[1] << 8 | trailer[2] << 16 | (size_t)trailer[3] << 24;
+		capacity = std::min<size_t>(size, (size_t)inputSize * 1032);
+	}
 
 	while (true) {
+		scratch.reset();
+		char* buffer = static_cast<char*>(scratch.allocate(capacity, 1));
 		libdeflate_result rv = LIBDEFLATE_BAD_DATA;
 
 		if (asGzip) {
@@ -122,8 +137,8 @@ void decompress_string(std::string& output, const char* input, uint32_t inputSiz
 				decompressor.decompressor,
 				input,
 				inputSize,
-				&output[0],
-				output.size(),
+				buffer,
+				capacity,
 				&uncompressedSize
 			);
 		} else {
@@ -131,22 +146,195 @@ void decompress_string(std::string& output, const char* input, uint32_t inputSiz
 				decompressor.decompressor,
 				input,
 				inputSize,
-				&output[0],
-				output.size(),
+				buffer,
+				capacity,
 				&uncompressedSize
 			);
 		}
 
 		if (rv == LIBDEFLATE_SUCCESS) {
-			output.resize(uncompressedSize);
+			output.assign(buffer, uncompressedSize);
 			return;
 		}
 
 		if (rv == LIBDEFLATE_INSUFFICIENT_SPACE) {
-			output.resize((output.size() + 128) * 2);
+			capacity = (capacity + 128) * 2;
+		} else
+			throw std::runtime_error(asGzip ? "libdeflate_gzip_decompress failed" : "libdeflate_zlib_decompress failed");
+	}
+}
+
+TileCompression detect_compression(const char* input, size_t inputSize) {
+	if (inputSize < 2)
+		return TileCompression::None;
+
+	const uint8_t b0 = input[0], b1 = input[1];
+
+	if (b0 == 0x1f && b1 == 0x8b)
+		return TileCompression::Gzip;
+
+	// A zlib header is CM=8 (deflate), CINFO<=7, and a check value that makes
+	// the first two bytes a multiple of 31. An uncompressed vector tile starts
+	// with 0x1a (field 3, length-delimited), which can't match.
+	if ((b0 & 0x0f) == 8 && (b0 >> 4) <= 7 && ((b0 << 8) | b1) % 31 == 0)
+		return TileCompression::Zlib;
+
+	return TileCompression::None;
+}
+
+bool parse_compression(const std::string& name, TileCompression& compression) {
+	if (name == "gzip") compression = TileCompression::Gzip;
+	else if (name == "zlib") compression = TileCompression::Zlib;
+	else if (name == "none") compression = TileCompression::None;
+	else return false;
+
+	return true;
+}
+
+const char* compression_name(TileCompression compression) {
+	switch (compression) {
+		case TileCompression::Gzip: return "gzip";
+		case TileCompression::Zlib: return "zlib";
+		default: return "none";
+	}
+}
+
+void decompress_tile(std::string& output, const char* input, size_t inputSize) {
+	switch (detect_compression(input, inputSize)) {
+		case TileCompression::Gzip:
+			decompress_string(output, input, inputSize, true);
+			break;
+		case TileCompression::Zlib:
+			decompress_string(output, input, inputSize, false);
+			break;
+		default:
+			output.assign(input, inputSize);
+	}
+}
+
+std::string compress_tile(const std::string& str, TileCompression compression, int compressionlevel) {
+	if (compression == TileCompression::None)
+		return str;
+
+	return compress_string(str, compressionlevel, compression == TileCompression::Gzip);
+}
+
+bool parse_zoom_levels(const std::string& spec, std::vector<int>& levels) {
+	auto parseInt = [](const std::string& str, int& value) {
+		char* end;
+		value = strtol(str.c_str(), &end, 10);
+		return !str.empty() && *end == '\0';
+	};
+
+	int level;
+	if (spec.find(':') == std::string::npos) {
+		if (!parseInt(spec, level) || level < 0 || level > 12)
+			return false;
+
+		std::fill(levels.begin(), levels.end(), level);
+		return true;
+	}
+
+	// split_string silently drops a trailing empty range
+	if (spec.back() == ',')
+		return false;
+
+	std::string copy = spec;
+	for (const auto& range : split_string(copy, ',')) {
+		size_t colon = range.find(':');
+		if (colon == std::string::npos)
+			return false;
+
+		std::string zooms = range.substr(0, colon);
+		size_t dash = zooms.find('-');
+		int minZoom, maxZoom;
+		if (dash == std::string::npos) {
+			if (!parseInt(zooms, minZoom))
+				return false;
+			maxZoom = minZoom;
+		} else if (!parseInt(zooms.substr(0, dash), minZoom) || !parseInt(zooms.substr(dash + 1), maxZoom))
+			return false;
+
+		if (!parseInt(range.substr(colon + 1), level) || level < 0 || level > 12)
+			return false;
+
+		if (minZoom < 0 || maxZoom < minZoom || maxZoom >= levels.size())
+			return false;
+
+		for (int zoom = minZoom; zoom <= maxZoom; zoom++)
+			levels[zoom] = level;
+	}
+
+	return true;
+}
+
+double getThreadCpuSeconds() {
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+std::vector<std::pair<std::string, int64_t>> readProcessIo() {
+	std::vector<std::pair<std::string, int64_t>> rv;
+	std::ifstream in("/proc/self/io");
+	std::string key;
+	int64_t value;
+	while (in >> key >> value) {
+		if (!key.empty() && key.back() == ':')
+			key.pop_back();
+		rv.push_back(std::make_pair(key, value));
+	}
+	return rv;
+}
+
+std::vector<std::pair<std::string, int64_t>> ioDelta(const std::vector<std::pair<std::string, int64_t>>& before, const std::vector<std::pair<std::string, int64_t>>& after) {
+	std::vector<std::pair<std::string, int64_t>> rv;
+	for (const auto& entry : after) {
+		int64_t previous = 0;
+		for (const auto& old : before)
+			if (old.first == entry.first)
+				previous = old.second;
+		rv.push_back(std::make_pair(entry.first, entry.second - previous));
+	}
+	return rv;
+}
+
+void appendUtf8(std::string& str, uint32_t cp) {
+	if (cp < 0x80) {
+		str += (char)cp;
+	} else if (cp < 0x800) {
+		str += (char)(0xC0 | (cp >> 6));
+		str += (char)(0x80 | (cp & 0x3F));
+	} else if (cp < 0x10000) {
+		str += (char)(0xE0 | (cp >> 12));
+		str += (char)(0x80 | ((cp >> 6) & 0x3F));
+		str += (char)(0x80 | (cp & 0x3F));
+	} else {
+		str += (char)(0xF0 | (cp >> 18));
+		str += (char)(0x80 | ((cp >> 12) & 0x3F));
+		str += (char)(0x80 | ((cp >> 6) & 0x3F));
+		str += (char)(0x80 | (cp & 0x3F));
+	}
+}
+
+// Quote a string for use in JSON.
+std::string escapeJsonString(const std::string& str) {
+	std::string rv = "\"";
+	for (unsigned char c : str) {
+		if (c == '"') rv += "\\\"";
+		else if (c == '\\') rv += "\\\\";
+		else if (c == '\n') rv += "\\n";
+		else if (c == '\r') rv += "\\r";
+		else if (c == '\t') rv += "\\t";
+		else if (c < 0x20) {
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", c);
+			rv += buf;
 		} else
-			throw std::runtime_error("libdeflate_gzip_decompress failed");
+			rv += c;
 	}
+	rv += "\"";
+	return rv;
 }
 
 // Parse a Boost error
@@ -176,6 +364,14 @@ uint64_t getFileSize(std::string filename) {
 	throw std::runtime_error("unable to stat " + filename);
 }
 
+bool isDirectory(const std::string& filename) {
+	struct stat64 statBuf;
+	if (stat64(filename.c_str(), &statBuf) != 0)
+		return false;
+
+	return S_ISDIR(statBuf.st_mode);
+}
+
 // Given a file, attempt to divide it into N chunks, with each chunk separated
 // by a newline.
 //
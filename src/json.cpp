@@ -0,0 +1,302 @@
+#include "json.h"
+#include "helpers.h"
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+// Deeper documents than this are rejected rather than risk the stack.
+#define JSON_MAX_DEPTH 256
+
+const JsonValue* JsonValue::get(const std::string& key) const {
+	for (const auto& member : object)
+		if (member.first == key)
+			return &member.second;
+	return NULL;
+}
+
+JsonValue* JsonValue::get(const std::string& key) {
+	for (auto& member : object)
+		if (member.first == key)
+			return &member.second;
+	return NULL;
+}
+
+namespace {
+
+class JsonParser {
+	const std::string& json;
+	size_t i;
+
+	[[noreturn]] void fail(const std::string& message) {
+		throw std::runtime_error("invalid JSON at offset " + std::to_string(i) + ": " + message);
+	}
+
+	void skipWhitespace() {
+		while (i < json.size() && isspace((unsigned char)json[i]))
+			i++;
+	}
+
+	void expect(char c) {
+		skipWhitespace();
+		if (i >= json.size() || json[i] != c)
+			fail(std::string("expected ") + c);
+		i++;
+	}
+
+	bool consume(const char* literal) {
+		size_t length = strlen(literal);
+		if (json.compare(i, length, literal) != 0)
+			return false;
+		i += length;
+		return true;
+	}
+
+	uint32_t parseHex4() {
+		if (i + 4 > json.size())
+			fail("truncated \\u escape");
+		uint32_t cp = 0;
+		for (int j = 0; j < 4; j++) {
+			char c = json[i++];
+			cp <<= 4;
+			if (c >= '0' && c <= '9') cp |= c - '0';
+			else if (c >= 'a' && c <= 'f') cp |= c - 'a' + 10;
+			else if (c >= 'A' && c <= 'F') cp |= c - 'A' + 10;
+			else fail("bad \\u escape");
+		}
+		return cp;
+	}
+
+	std::string parseString() {
+		expect('"');
+		std::string str;
+		while (true) {
+			if (i >= json.size())
+				fail("unterminated string");
+
+			char c = json[i++];
+			if (c == '"')
+				return str;
+			if (c != '\\') {
+				str += c;
+				continue;
+			}
+
+			if (i >= json.size())
+				fail("unterminated string");
+			c = json[i++];
+			switch (c) {
+				case 'b': str += '\b'; break;
+				case 'f': str += '\f'; break;
+				case 'n': str += '\n'; break;
+				case 'r': str += '\r'; break;
+				case 't': str += '\t'; break;
+				case 'u': {
+					uint32_t cp = parseHex4();
+					if (cp >= 0xD800 && cp <= 0xDBFF && json.compare(i, 2, "\\u") == 0) {
+						i += 2;
+						uint32_t low = parseHex4();
+						cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+					}
+					appendUtf8(str, cp);
+					break;
+				}
+				default: str += c;
+			}
+		}
+	}
+
+public:
+	JsonParser(const std::string& json): json(json), i(0) {}
+
+	JsonValue parseValue(int depth) {
+		if (depth > JSON_MAX_DEPTH)
+			fail("nested too deeply");
+
+		JsonValue value;
+		skipWhitespace();
+		if (i >= json.size())
+			fail("unexpected end");
+
+		char c = json[i];
+		if (c == '{') {
+			value.type = JsonValue::Type::Object;
+			i++;
+			skipWhitespace();
+			if (i < json.size() && json[i] == '}') {
+				i++;
+				return value;
+			}
+			while (true) {
+				std::string key = parseString();
+				expect(':');
+				value.object.push_back(std::make_pair(key, parseValue(depth + 1)));
+				skipWhitespace();
+				if (i < json.size() && json[i] == ',') {
+					i++;
+					skipWhitespace();
+					continue;
+				}
+				expect('}');
+				return value;
+			}
+		}
+
+		if (c == '[') {
+			value.type = JsonValue::Type::Array;
+			i++;
+			skipWhitespace();
+			if (i < json.size() && json[i] == ']') {
+				i++;
+				return value;
+			}
+			while (true) {
+				value.array.push_back(parseValue(depth + 1));
+				skipWhitespace();
+				if (i < json.size() && json[i] == ',') {
+					i++;
+					continue;
+				}
+				expect(']');
+				return value;
+			}
+		}
+
+		if (c == '"') {
+			value.type = JsonValue::Type::String;
+			value.string = parseString();
+			return value;
+		}
+
+		if (consume("true")) {
+			value.type = JsonValue::Type::Boolean;
+			value.boolean = true;
+			return value;
+		}
+		if (consume("false")) {
+			value.type = JsonValue::Type::Boolean;
+			return value;
+		}
+		if (consume("null"))
+			return value;
+
+		size_t start = i;
+		while (i < json.size() && (isdigit((unsigned char)json[i]) || strchr("+-.eE", json[i])))
+			i++;
+		if (i == start)
+			fail(std::string("unexpected ") + c);
+
+		value.type = JsonValue::Type::Number;
+		value.string = json.substr(start, i - start);
+		char* end;
+		value.number = strtod(value.string.c_str(), &end);
+		if (*end != '\0')
+			fail("bad number " + value.string);
+		return value;
+	}
+
+	void finish() {
+		skipWhitespace();
+		if (i != json.size())
+			fail("trailing characters");
+	}
+};
+
+}
+
+JsonValue parseJson(const std::string& json) {
+	JsonParser parser(json);
+	JsonValue value = parser.parseValue(0);
+	parser.finish();
+	return value;
+}
+
+std::string writeJson(const JsonValue& value) {
+	switch (value.type) {
+		case JsonValue::Type::Null: return "null";
+		case JsonValue::Type::Boolean: return value.boolean ? "true" : "false";
+		case JsonValue::Type::Number: return value.string;
+		case JsonValue::Type::String: return escapeJsonString(value.string);
+		case JsonValue::Type::Array: {
+			std::string json = "[";
+			for (size_t i = 0; i < value.array.size(); i++) {
+				if (i > 0)
+					json += ",";
+				json += writeJson(value.array[i]);
+			}
+			return json + "]";
+		}
+		case JsonValue::Type::Object: {
+			std::string json = "{";
+			for (size_t i = 0; i < value.object.size(); i++) {
+				if (i > 0)
+					json += ",";
+				json += escapeJsonString(value.object[i].first) + ":" + writeJson(value.object[i].second);
+			}
+			return json + "}";
+		}
+	}
+	return "null";
+}
+
+void VectorLayers::add(const JsonValue& vectorLayers) {
+	if (vectorLayers.type != JsonValue::Type::Array)
+		throw std::runtime_error("vector_layers isn't an array");
+
+	for (const auto& layer : vectorLayers.array) {
+		const JsonValue* id = layer.get("id");
+		if (layer.type != JsonValue::Type::Object || !id || id->type != JsonValue::Type::String)
+			throw std::runtime_error("vector_layers has a layer without an id");
+
+		auto existing = layers.find(id->string);
+		if (existing == layers.end()) {
+			layers[id->string] = layer;
+			continue;
+		}
+		JsonValue& merged = existing->second;
+
+		for (const char* key : { "minzoom", "maxzoom" }) {
+			const JsonValue* zoom = layer.get(key);
+			if (!zoom || zoom->type != JsonValue::Type::Number)
+				continue;
+
+			JsonValue* mergedZoom = merged.get(key);
+			if (!mergedZoom || mergedZoom->type != JsonValue::Type::Number)
+				merged.object.push_back(std::make_pair(key, *zoom));
+			else if (key[1] == 'i' ? zoom->number < mergedZoom->number : zoom->number > mergedZoom->number)
+				*mergedZoom = *zoom;
+		}
+
+		const JsonValue* fields = layer.get("fields");
+		if (!fields || fields->type != JsonValue::Type::Object)
+			continue;
+
+		JsonValue* mergedFields = merged.get("fields");
+		if (!mergedFields || mergedFields->type != JsonValue::Type::Object) {
+			merged.object.push_back(std::make_pair("fields", *fields));
+			continue;
+		}
+
+		for (const auto& field : fields->object) {
+			JsonValue* mergedField = mergedFields->get(field.first);
+			if (!mergedField) {
+				mergedFields->object.push_back(field);
+			} else if (mergedField->type != field.second.type || mergedField->string != field.second.string) {
+				mergedField->type = JsonValue::Type::String;
+				mergedField->string = "Mixed";
+			}
+		}
+	}
+}
+
+std::string VectorLayers::toJson() const {
+	std::string json = "[";
+	for (const auto& layer : layers) {
+		if (json.size() > 1)
+			json += ",";
+		json += writeJson(layer.second);
+	}
+	return json + "]";
+}
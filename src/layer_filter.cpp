@@ -0,0 +1,130 @@
+#include "layer_filter.h"
+#include "layer_merge.h"
+#include <algorithm>
+#include <fnmatch.h>
+#include <protozero/pbf_reader.hpp>
+#include <protozero/pbf_writer.hpp>
+
+using namespace std;
+
+// From the vector tile spec: Tile.layers, and Layer.name.
+#define TILE_LAYERS_TAG 3
+#define LAYER_NAME_TAG 1
+
+static bool matchesAny(const std::vector<std::string>& globs, const std::string& name) {
+	for (const auto& glob : globs)
+		if (fnmatch(glob.c_str(), name.c_str(), 0) == 0)
+			return true;
+	return false;
+}
+
+static std::string layerName(protozero::data_view layer) {
+	protozero::pbf_reader reader{layer};
+	if (reader.next(LAYER_NAME_TAG, protozero::pbf_wire_type::length_delimited))
+		return reader.get_string();
+	return "";
+}
+
+bool LayerFilter::apply(const std::string& name, std::string& renamed) const {
+	if (!includes.empty() && !matchesAny(includes, name))
+		return false;
+	if (matchesAny(excludes, name))
+		return false;
+
+	renamed = name;
+	for (const auto& rename : renames) {
+		if (rename.first == name) {
+			renamed = rename.second;
+			break;
+		}
+	}
+	return true;
+}
+
+bool LayerFilter::filterTile(const std::string& tile, std::string& output) const {
+	// Most tiles are usually untouched, so check before copying anything.
+	std::string renamed;
+	bool changed = false;
+	protozero::pbf_reader check{tile};
+	while (!changed && check.next(TILE_LAYERS_TAG, protozero::pbf_wire_type::length_delimited)) {
+		std::string name = layerName(check.get_view());
+		changed = !apply(name, renamed) || renamed != name;
+	}
+	if (!changed)
+		return false;
+
+	output.clear();
+	protozero::pbf_writer writer{output};
+	protozero::pbf_reader reader{tile};
+	std::string layer;
+	std::vector<std::string> kept;
+	bool repeated = false, anyRenamed = false;
+	while (true) {
+		const char* start = reader.data().data();
+		if (!reader.next())
+			break;
+
+		if (reader.tag() != TILE_LAYERS_TAG || reader.wire_type() != protozero::pbf_wire_type::length_delimited) {
+			reader.skip();
+			output.append(start, reader.data().data() - start);
+			continue;
+		}
+
+		protozero::data_view view = reader.get_view();
+		std::string name = layerName(view);
+		if (!apply(name, renamed))
+			continue;
+		repeated = repeated || std::find(kept.begin(), kept.end(), renamed) != kept.end();
+		kept.push_back(renamed);
+		if (renamed == name) {
+			output.append(start, reader.data().data() - start);
+			continue;
+		}
+
+		// Write the new name, then copy every other field of the layer as-is.
+		layer.clear();
+		{
+			protozero::pbf_writer layerWriter{layer};
+			layerWriter.add_string(LAYER_NAME_TAG, renamed);
+		}
+		protozero::pbf_reader fields{view};
+		while (true) {
+			const char* fieldStart = fields.data().data();
+			if (!fields.next())
+				break;
+			bool isName = fields.tag() == LAYER_NAME_TAG;
+			fields.skip();
+			if (!isName)
+				layer.append(fieldStart, fields.data().data() - fieldStart);
+		}
+		writer.add_message(TILE_LAYERS_TAG, layer);
+		anyRenamed = true;
+	}
+
+	// A layer renamed to the name of another in the same tile joins it.
+	if (repeated && anyRenamed) {
+		std::vector<vtzero::layer> layers;
+		vtzero::vector_tile filtered{output};
+		while (auto next = filtered.next_layer())
+			layers.push_back(next);
+		std::string merged;
+		mergeTileLayers(layers, merged);
+		output.swap(merged);
+	}
+	return true;
+}
+
+void LayerFilter::filterLayerList(JsonValue& layers, const char* nameKey) const {
+	std::vector<JsonValue> kept;
+	std::string renamed;
+	for (auto& layer : layers.array) {
+		JsonValue* name = layer.get(nameKey);
+		if (name && name->type == JsonValue::Type::String) {
+			if (!apply(name->string, renamed))
+				continue;
+			name->string = renamed;
+		}
+		kept.push_back(std::move(layer));
+	}
+	layers.array = std::move(kept);
+}
@@ -0,0 +1,137 @@
+#include "layer_merge.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+#include <vtzero/builder.hpp>
+#include <vtzero/index.hpp>
+#include "external/libdeflate/libdeflate.h"
+
+using namespace std;
+
+static void mergeLayers(vtzero::tile_builder& builder, std::vector<vtzero::layer>& layers, const std::vector<size_t>& group) {
+	const vtzero::layer& first = layers[group[0]];
+	const std::string name(first.name());
+	uint32_t version = first.version();
+	for (size_t i : group) {
+		if (layers[i].extent() != first.extent())
+			throw std::runtime_error("can't merge layer " + name + ": its extent is " + std::to_string(first.extent()) + " in one tile and " + std::to_string(layers[i].extent()) + " in another");
+		version = std::max(version, layers[i].version());
+	}
+
+	vtzero::layer_builder layer{builder, name, version, first.extent()};
+	vtzero::key_index<std::unordered_map> keyIndex{layer};
+
+	// Values are looked up by their encoded bytes, which are already in
+	// each source layer's table, rather than re-encoding them.
+	std::unordered_map<std::string, vtzero::index_value> valueIndex;
+
+	// Each source layer's key and value indexes, mapped into the new
+	// layer's tables the first time a feature uses them.
+	std::vector<vtzero::index_value> keys;
+	std::vector<vtzero::index_value> values;
+
+	for (size_t i : group) {
+		vtzero::layer& source = layers[i];
+		keys.assign(source.key_table().size(), vtzero::index_value());
+		values.assign(source.value_table().size(), vtzero::index_value());
+
+		while (auto feature = source.next_feature()) {
+			vtzero::geometry_feature_builder copy{layer};
+			if (feature.has_id())
+				copy.set_id(feature.id());
+			copy.set_geometry(feature.geometry());
+			feature.for_each_property_indexes([&](const vtzero::index_value_pair& indexes) {
+				vtzero::index_value& key = keys.at(indexes.key().value());
+				if (!key.valid())
+					key = keyIndex(source.key(indexes.key()));
+
+				vtzero::index_value& value = values.at(indexes.value().value());
+				if (!value.valid()) {
+					const vtzero::property_value property = source.value(indexes.value());
+					std::string encoded(property.data());
+					auto it = valueIndex.find(encoded);
+					if (it == valueIndex.end())
+						it = valueIndex.emplace(std::move(encoded), layer.add_value_without_dup_check(property)).first;
+					value = it->second;
+				}
+
+				copy.add_property(key, value);
+				return true;
+			});
+			copy.commit();
+		}
+	}
+}
+
+void readTileLayers(const std::vector<std::string>& tiles, std::vector<vtzero::layer>& layers) {
+	for (const auto& tile : tiles) {
+		vtzero::vector_tile existingTile{tile};
+		while (auto layer = existingTile.next_layer())
+			layers.push_back(layer);
+	}
+}
+
+size_t dropDuplicateLayers(std::vector<vtzero::layer>& layers, bool firstWins) {
+	// There are rarely more than a few dozen layers, so rather than a hash
+	// table, each layer's hash is compared with those of the layers kept
+	// before it.
+	thread_local std::vector<uint32_t> hashes;
+	hashes.clear();
+
+	size_t kept = 0;
+	for (size_t i = 0; i < layers.size(); i++) {
+		// Identical layers have the same name, so with firstWins, comparing
+		// names is enough.
+		bool duplicate = false;
+		if (firstWins) {
+			for (size_t j = 0; j < kept && !duplicate; j++)
+				duplicate = layers[j].name() == layers[i].name();
+		} else {
+			const vtzero::data_view data = layers[i].data();
+			const uint32_t hash = libdeflate_crc32(0, data.data(), data.size());
+			for (size_t j = 0; j < kept && !duplicate; j++)
+				duplicate = hashes[j] == hash && layers[j].data().size() == data.size() &&
+					memcmp(layers[j].data().data(), data.data(), data.size()) == 0;
+			if (!duplicate)
+				hashes.push_back(hash);
+		}
+		if (duplicate)
+			continue;
+
+		if (kept != i)
+			layers[kept] = layers[i];
+		kept++;
+	}
+
+	size_t dropped = layers.size() - kept;
+	layers.resize(kept);
+	return dropped;
+}
+
+bool mergeTileLayers(std::vector<vtzero::layer>& layers, std::string& output) {
+	std::vector<std::string> names;
+	std::unordered_map<std::string, std::vector<size_t>> groups;
+	for (size_t i = 0; i < layers.size(); i++) {
+		std::string name(layers[i].name());
+		auto& group = groups[name];
+		if (group.empty())
+			names.push_back(name);
+		group.push_back(i);
+	}
+	if (names.size() == layers.size())
+		return false;
+
+	// Layers go in the order their names first appear.
+	vtzero::tile_builder builder;
+	for (const auto& name : names) {
+		const auto& group = groups[name];
+		if (group.size() == 1)
+			builder.add_existing_layer(layers[group[0]]);
+		else
+			mergeLayers(builder, layers, group);
+	}
+	output.clear();
+	builder.serialize(output);
+	return true;
+}
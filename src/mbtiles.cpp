@@ -1,6 +1,9 @@
 #include "mbtiles.h"
 #include "helpers.h"
+#include "stats.h"
+#include "memory_budget.h"
 #include <iostream>
+#include <algorithm>
 #include <cmath>
 #include <fcntl.h>
 #include <unistd.h>
@@ -12,6 +15,7 @@ using namespace std;
 Flock::Flock(int fd) {
 	fd_ = 0;
 
+	StageTimer timer(Stage::LockWait);
 	int rv = flock(fd, LOCK_EX);
 	if (rv == 0)
 		fd_ = fd;
@@ -24,10 +28,12 @@ Flock::~Flock() {
 		flock(fd_, LOCK_UN);
 }
 
-MBTiles::MBTiles():
+MBTiles::MBTiles(const MBTilesReadOptions& readOptions):
 	inTransaction(false),
+	readOptions(readOptions),
   pendingStatements1(std::make_shared<std::vector<PendingStatement>>()),
-  pendingStatements2(std::make_shared<std::vector<PendingStatement>>())
+  pendingStatements2(std::make_shared<std::vector<PendingStatement>>()),
+	pendingBytes(0)
 {
 	lockfd = 0;
 	lockfd = open("./lockfile", O_CREAT, 0644);
@@ -118,6 +124,7 @@ void MBTiles::insertOrReplace(int zoom, int x, int y, const std::string& data, b
 }
 
 void MBTiles::flushPendingStatements() {
+	StageTimer timer(Stage::Flush);
 	Flock lock(lockfd);
 
 	db << "BEGIN";
@@ -133,13 +140,18 @@ void MBTiles::flushPendingStatements() {
 	}
 
 	db << "COMMIT";
+
+	memoryBudget.releaseBuffered(pendingBytes);
+	pendingBytes = 0;
 }
 	
 void MBTiles::saveTile(int zoom, int x, int y, string *data, bool isMerge) {
 	//std::cerr << "writing zoom=" << std::to_string(zoom) << " x=" << std::to_string(x) << " y=" << std::to_string(y) << std::endl;
 	pendingStatements1->push_back({zoom, x, y, *data, isMerge});
+	pendingBytes += data->size();
+	memoryBudget.chargeBuffered(data->size());
 
-	if (pendingStatements1->size() > 10000)
+	if (pendingStatements1->size() > 10000 || memoryBudget.shouldFlush(pendingBytes))
 		flushPendingStatements();
 }
 
@@ -176,6 +188,83 @@ void MBTiles::openForReading(string &filename) {
 	uri += "?immutable=1&mode=ro";
 	db.init(uri.c_str(), SQLITE_OPEN_READONLY | SQLITE_OPEN_URI | SQLITE_OPEN_NOMUTEX);
 	this->filename = filename;
+
+	// SQLite caps this at SQLITE_MAX_MMAP_SIZE, which it was built with.
+	if (readOptions.mmap)
+		db << "PRAGMA mmap_size = " + std::to_string(getFileSize(filename));
+
+	// A negative cache_size is in KiB rather than pages.
+	if (readOptions.cacheKiB > 0)
+		db << "PRAGMA cache_size = -" + std::to_string(readOptions.cacheKiB);
+
+#ifdef POSIX_FADV_WILLNEED
+	if (readOptions.readAhead) {
+		int fd = open(filename.c_str(), O_RDONLY);
+		if (fd != -1) {
+			posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+			close(fd);
+		}
+	}
+#endif
+
+	if (readOptions.directBtree)
+		openBtree();
+}
+
+// Work out where the tiles table and an index on exactly (zoom_level,
+// tile_column, tile_row) live, and where tile_data sits in the table's
+// records. Anything else (views, WITHOUT ROWID tables, partial or
+// descending indexes...) is left to SQLite.
+void MBTiles::openBtree() {
+	int tilesRoot = 0;
+	std::string tilesSql;
+	db << "SELECT rootpage, sql FROM sqlite_master WHERE type='table' AND name='tiles'" >> [&](int rootpage, std::string sql) {
+		tilesRoot = rootpage;
+		tilesSql = sql;
+	};
+	std::transform(tilesSql.begin(), tilesSql.end(), tilesSql.begin(), ::toupper);
+
+	int tileDataColumn = -1;
+	bool hiddenColumns = false;
+	db << "SELECT cid, name, hidden FROM pragma_table_xinfo('tiles')" >> [&](int cid, std::string name, int hidden) {
+		if (name == "tile_data")
+			tileDataColumn = cid;
+		if (hidden != 0)
+			hiddenColumns = true;
+	};
+
+	int indexRoot = 0;
+	std::vector<std::string> indexes;
+	db << "SELECT name FROM pragma_index_list('tiles') WHERE partial=0" >> [&](std::string name) {
+		indexes.push_back(name);
+	};
+	for (const auto& index : indexes) {
+		std::vector<std::string> columns;
+		bool ascending = true;
+		db << "SELECT name, desc, coll FROM pragma_index_xinfo(?) WHERE key=1 ORDER BY seqno" << index >> [&](std::string name, int desc, std::string coll) {
+			columns.push_back(name);
+			if (desc != 0 || coll != "BINARY")
+				ascending = false;
+		};
+
+		if (ascending && columns == std::vector<std::string>{ "zoom_level", "tile_column", "tile_row" }) {
+			db << "SELECT rootpage FROM sqlite_master WHERE type='index' AND name=?" << index >> indexRoot;
+			break;
+		}
+	}
+
+	if (tilesRoot <= 0 || tilesSql.find("WITHOUT ROWID") != std::string::npos || tileDataColumn < 0 || hiddenColumns || indexRoot <= 0) {
+		std::cout << "note: " << filename << " doesn't have the usual tiles table and index, reading it via SQLite" << std::endl;
+		return;
+	}
+
+	btree.reset(new SqliteBtreeReader());
+	try {
+		btree->open(filename, tilesRoot, indexRoot, tileDataColumn);
+	} catch (std::runtime_error &e) {
+		std::cout << "note: reading " << filename << " via SQLite: " << e.what() << std::endl;
+		btree.reset();
+	}
 }
 
 void MBTiles::readBoundingBox(double &minLon, double &maxLon, double &minLat, double &maxLat) {
@@ -186,8 +275,50 @@ void MBTiles::readBoundingBox(double &minLon, double &maxLon, double &minLat, do
 	maxLon = stod(b[2]); maxLat = stod(b[3]);
 }
 
-vector<char> MBTiles::readTile(int zoom, int col, int row) {
-	vector<char> pbfBlob;
-	db << "SELECT tile_data FROM tiles WHERE zoom_level=? AND tile_column=? AND tile_row=?" << zoom << col << row >> pbfBlob;
-	return pbfBlob;
+protozero::data_view MBTiles::readTile(int zoom, int col, int row, vector<char>& buffer) {
+	if (btree) {
+		try {
+			protozero::data_view tile;
+			if (btree->readTile(zoom, col, row, tile, buffer))
+				return tile;
+			return { nullptr, 0 };
+		} catch (std::runtime_error &e) {
+			std::cout << "note: reading " << filename << " via SQLite from now on: " << e.what() << std::endl;
+			btree.reset();
+		}
+	}
+
+	// The view points into SQLite's copy of the row, which stays put until
+	// the statement is next reset, i.e. the next readTile.
+	database_binder& statement = db.prepared("SELECT tile_data FROM tiles WHERE zoom_level=? AND tile_column=? AND tile_row=?");
+	statement.reset();
+	statement << zoom << col << row;
+	sqlite::blob_view tile = statement.single_blob();
+	return { tile.data, tile.size };
+}
+
+std::vector<std::pair<std::string, int64_t>> MBTiles::ioCounters() {
+	std::vector<std::pair<std::string, int64_t>> rv;
+	if (!db)
+		return rv;
+
+	// This connection's page cache. SQLITE_CONFIG_MEMSTATUS is off, so the
+	// process-wide sqlite3_status counters aren't kept.
+	const std::pair<const char*, int> counters[] = {
+		{ "cache_hit", SQLITE_DBSTATUS_CACHE_HIT },
+		{ "cache_miss", SQLITE_DBSTATUS_CACHE_MISS },
+		{ "cache_write", SQLITE_DBSTATUS_CACHE_WRITE },
+#ifdef SQLITE_DBSTATUS_CACHE_SPILL
+		{ "cache_spill", SQLITE_DBSTATUS_CACHE_SPILL },
+#endif
+		{ "cache_used_bytes", SQLITE_DBSTATUS_CACHE_USED },
+	};
+
+	for (const auto& counter : counters) {
+		int current = 0, highwater = 0;
+		if (sqlite3_db_status(db.connection().get(), counter.second, &current, &highwater, 0) == SQLITE_OK)
+			rv.push_back(std::make_pair(counter.first, current));
+	}
+
+	return rv;
 }
@@ -0,0 +1,77 @@
+#include "memory_budget.h"
+#include "stats.h"
+#include <chrono>
+
+using namespace std;
+
+MemoryBudget memoryBudget;
+
+MemoryBudget::MemoryBudget():
+	limit(0),
+	inFlight(0),
+	buffered(0),
+	peak(0),
+	waits(0),
+	waiters(0),
+	cancelled(false)
+{
+}
+
+void MemoryBudget::notePeak() {
+	int64_t used = inFlight + buffered;
+	int64_t previous = peak;
+	while (used > previous && !peak.compare_exchange_weak(previous, used))
+		;
+}
+
+void MemoryBudget::acquire(uint64_t bytes, uint64_t held) {
+	auto mustWait = [&]() {
+		return !cancelled && inFlight > (int64_t)held && (uint64_t)(inFlight + buffered) + bytes > limit;
+	};
+
+	if (limit > 0 && mustWait()) {
+		waits++;
+		StageTimer timer(Stage::MemoryWait);
+		std::unique_lock<std::mutex> lock(mutex);
+		waiters++;
+		// release() notifies, but only after checking for waiters without the
+		// lock, so wake up now and then in case that raced with us.
+		while (mustWait())
+			cv.wait_for(lock, std::chrono::milliseconds(10));
+		waiters--;
+	}
+
+	charge(bytes);
+}
+
+void MemoryBudget::cancel() {
+	cancelled = true;
+	std::lock_guard<std::mutex> lock(mutex);
+	cv.notify_all();
+}
+
+void MemoryBudget::charge(int64_t bytes) {
+	inFlight += bytes;
+	notePeak();
+}
+
+void MemoryBudget::release(int64_t bytes) {
+	inFlight -= bytes;
+	if (waiters > 0) {
+		std::lock_guard<std::mutex> lock(mutex);
+		cv.notify_all();
+	}
+}
+
+void MemoryBudget::chargeBuffered(int64_t bytes) {
+	buffered += bytes;
+	notePeak();
+}
+
+void MemoryBudget::releaseBuffered(int64_t bytes) {
+	buffered -= bytes;
+	if (waiters > 0) {
+		std::lock_guard<std::mutex> lock(mutex);
+		cv.notify_all();
+	}
+}
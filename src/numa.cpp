@@ -0,0 +1,153 @@
+#include "numa.h"
+#include "helpers.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <dirent.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
+using namespace std;
+
+#define NUMA_SYSFS "/sys/devices/system/node"
+
+// From linux/mempolicy.h, which isn't always installed.
+#define NUMA_MPOL_PREFERRED 1
+
+std::vector<int> parseCpuList(const std::string& list) {
+	std::vector<int> cpus;
+	std::string copy = list;
+	for (auto& range : split_string(copy, ',')) {
+		if (range.empty() || range == "\n")
+			continue;
+
+		size_t dash = range.find('-');
+		int first = atoi(range.c_str());
+		int last = dash == std::string::npos ? first : atoi(range.c_str() + dash + 1);
+		for (int cpu = first; cpu <= last; cpu++)
+			cpus.push_back(cpu);
+	}
+	return cpus;
+}
+
+static std::string readFirstLine(const std::string& filename) {
+	std::ifstream in(filename);
+	std::string line;
+	std::getline(in, line);
+	return line;
+}
+
+std::vector<NumaNode> readNumaTopology() {
+	std::vector<NumaNode> nodes;
+	DIR* dir = opendir(NUMA_SYSFS);
+	if (!dir)
+		return nodes;
+
+	while (struct dirent* entry = readdir(dir)) {
+		std::string name = entry->d_name;
+		if (name.compare(0, 4, "node") != 0 || name.size() == 4 || !isdigit(name[4]))
+			continue;
+
+		NumaNode node;
+		node.id = atoi(name.c_str() + 4);
+		node.cpus = parseCpuList(readFirstLine(NUMA_SYSFS "/" + name + "/cpulist"));
+		if (!node.cpus.empty())
+			nodes.push_back(node);
+	}
+	closedir(dir);
+
+	std::sort(nodes.begin(), nodes.end(), [](const NumaNode& a, const NumaNode& b) { return a.id < b.id; });
+	return nodes;
+}
+
+bool bindToNumaNode(const NumaNode& node) {
+#ifdef __linux__
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	for (int cpu : node.cpus)
+		if (cpu < CPU_SETSIZE)
+			CPU_SET(cpu, &cpus);
+	bool ok = sched_setaffinity(0, sizeof(cpus), &cpus) == 0;
+
+#ifdef SYS_set_mempolicy
+	// Memory is already allocated on the node of the CPU that first touches
+	// it, so this only matters once the node runs out. Preferring (rather
+	// than binding to) the node lets allocations spill over then instead of
+	// failing.
+	std::vector<unsigned long> mask(node.id / (8 * sizeof(unsigned long)) + 1, 0);
+	mask[node.id / (8 * sizeof(unsigned long))] |= 1ul << (node.id % (8 * sizeof(unsigned long)));
+	if (syscall(SYS_set_mempolicy, NUMA_MPOL_PREFERRED, mask.data(), mask.size() * 8 * sizeof(unsigned long) + 1) != 0)
+		ok = false;
+#endif
+
+	return ok;
+#else
+	// No CPU affinity to set elsewhere; callers note that it didn't bind.
+	(void)node;
+	return false;
+#endif
+}
+
+uint64_t tileShard(int zoom, int x, int y, uint64_t shards, uint64_t nodes) {
+	uint64_t index = (uint64_t)x * (1 << zoom) + y;
+	if (nodes <= 1)
+		return index % shards;
+
+	// Aim for at least 16 blocks of columns per node at each zoom.
+	int nodeBits = 0;
+	while ((1ull << nodeBits) < nodes)
+		nodeBits++;
+	int blockBits = std::max(0, zoom - 4 - nodeBits);
+
+	uint64_t node = ((uint64_t)x >> blockBits) % nodes;
+	uint64_t nodeShards = shards / nodes + (node < shards % nodes ? 1 : 0);
+	return node + (index % nodeShards) * nodes;
+}
+
+std::vector<std::pair<std::string, int64_t>> readNumaCounters() {
+	std::vector<std::pair<std::string, int64_t>> rv;
+	for (const auto& node : readNumaTopology()) {
+		std::ifstream in(NUMA_SYSFS "/node" + std::to_string(node.id) + "/numastat");
+		std::string key;
+		int64_t value;
+		while (in >> key >> value)
+			rv.push_back(std::make_pair("node" + std::to_string(node.id) + "_" + key, value));
+	}
+	return rv;
+}
+
+std::vector<std::pair<std::string, int64_t>> readNumaPages() {
+	// Each mapping's line has an N<node>=<pages> entry for every node it has
+	// pages on, and its page size.
+	std::map<int, int64_t> bytes;
+	std::ifstream in("/proc/self/numa_maps");
+	std::string line;
+	while (std::getline(in, line)) {
+		std::istringstream fields(line);
+		std::string field;
+		int64_t pageSize = 4096;
+		std::vector<std::pair<int, int64_t>> pages;
+		while (fields >> field) {
+			if (field.size() > 1 && field[0] == 'N' && isdigit(field[1])) {
+				size_t equals = field.find('=');
+				if (equals != std::string::npos)
+					pages.push_back(std::make_pair(atoi(field.c_str() + 1), atoll(field.c_str() + equals + 1)));
+			} else if (field.compare(0, 18, "kernelpagesize_kB=") == 0) {
+				pageSize = atoll(field.c_str() + 18) * 1024;
+			}
+		}
+
+		for (const auto& entry : pages)
+			bytes[entry.first] += entry.second * pageSize;
+	}
+
+	std::vector<std::pair<std::string, int64_t>> rv;
+	for (const auto& entry : bytes)
+		rv.push_back(std::make_pair("node" + std::to_string(entry.first) + "_bytes", entry.second));
+	return rv;
+}
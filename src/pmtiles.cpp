@@ -0,0 +1,282 @@
+#include "pmtiles.h"
+#include "helpers.h"
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <protozero/varint.hpp>
+
+using namespace std;
+
+// Leaf directories may not point at further leaves in practice, but the spec
+// doesn't forbid it. Guard against malformed archives that loop.
+#define PMTILES_MAX_DIRECTORY_DEPTH 4
+
+static uint64_t readUint64(const char* p) {
+	uint64_t rv = 0;
+	for (int i = 7; i >= 0; i--)
+		rv = (rv << 8) | (uint8_t)p[i];
+	return rv;
+}
+
+static int32_t readInt32(const char* p) {
+	uint32_t rv = 0;
+	for (int i = 3; i >= 0; i--)
+		rv = (rv << 8) | (uint8_t)p[i];
+	return (int32_t)rv;
+}
+
+static void rotate(uint64_t n, uint32_t &x, uint32_t &y, uint32_t rx, uint32_t ry) {
+	if (ry == 0) {
+		if (rx == 1) {
+			x = n - 1 - x;
+			y = n - 1 - y;
+		}
+		std::swap(x, y);
+	}
+}
+
+uint64_t zxyToTileId(uint8_t z, uint32_t x, uint32_t y) {
+	// Number of tiles in all of the zooms before this one, i.e. (4^z - 1) / 3
+	uint64_t acc = ((1ull << (z * 2)) - 1) / 3;
+	uint64_t n = 1ull << z;
+	uint64_t d = 0;
+	for (uint64_t s = n / 2; s > 0; s /= 2) {
+		uint32_t rx = (x & s) > 0;
+		uint32_t ry = (y & s) > 0;
+		d += s * s * ((3 * rx) ^ ry);
+		rotate(n, x, y, rx, ry);
+	}
+	return acc + d;
+}
+
+void tileIdToZxy(uint64_t tileId, uint8_t &z, uint32_t &x, uint32_t &y) {
+	uint64_t acc = 0;
+	for (z = 0; z < 32; z++) {
+		uint64_t tiles = 1ull << (z * 2);
+		if (acc + tiles > tileId)
+			break;
+		acc += tiles;
+	}
+
+	if (z == 32)
+		throw std::runtime_error("tile ID " + std::to_string(tileId) + " is out of range");
+
+	uint64_t t = tileId - acc;
+	x = 0;
+	y = 0;
+	for (uint64_t s = 1; s < (1ull << z); s *= 2) {
+		uint32_t rx = 1 & (t / 2);
+		uint32_t ry = 1 & (t ^ rx);
+		rotate(s, x, y, rx, ry);
+		x += s * rx;
+		y += s * ry;
+		t /= 4;
+	}
+}
+
+PMTiles::PMTiles(bool readAhead):
+	readAhead(readAhead),
+	fd(-1),
+	data(NULL),
+	size(0)
+{
+}
+
+PMTiles::~PMTiles() {
+	if (data)
+		munmap((void*)data, size);
+
+	if (fd != -1)
+		close(fd);
+}
+
+void PMTiles::openForReading(string &filename) {
+	this->filename = filename;
+
+	fd = open(filename.c_str(), O_RDONLY);
+	if (fd == -1)
+		throw std::runtime_error("unable to open " + filename);
+
+	size = getFileSize(filename);
+	if (size < PMTILES_HEADER_SIZE)
+		throw std::runtime_error(filename + " is too small to be a PMTiles archive");
+
+	void* mapped = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (mapped == MAP_FAILED)
+		throw std::runtime_error("unable to mmap " + filename);
+	data = (const char*)mapped;
+
+	if (readAhead)
+		madvise(mapped, size, MADV_WILLNEED);
+
+	if (memcmp(data, "PMTiles", 7) != 0)
+		throw std::runtime_error(filename + " is not a PMTiles archive");
+
+	if (data[7] != 3)
+		throw std::runtime_error(filename + " is PMTiles v" + std::to_string((int)data[7]) + ", only v3 is supported");
+
+	uint64_t rootDirOffset = readUint64(data + 8);
+	uint64_t rootDirLength = readUint64(data + 16);
+	metadataOffset = readUint64(data + 24);
+	metadataLength = readUint64(data + 32);
+	leafDirsOffset = readUint64(data + 40);
+	leafDirsLength = readUint64(data + 48);
+	tileDataOffset = readUint64(data + 56);
+	internalCompression = data[97];
+	tileCompression = data[98];
+	minZoom = data[100];
+	maxZoom = data[101];
+	minLon = readInt32(data + 102) / 10000000.0;
+	minLat = readInt32(data + 106) / 10000000.0;
+	maxLon = readInt32(data + 110) / 10000000.0;
+	maxLat = readInt32(data + 114) / 10000000.0;
+
+	// Tiles' codecs are detected one by one when they're merged, but that only
+	// knows about deflate-based codecs.
+	if (tileCompression != PMTILES_COMPRESSION_UNKNOWN && tileCompression != PMTILES_COMPRESSION_NONE && tileCompression != PMTILES_COMPRESSION_GZIP)
+		throw std::runtime_error(filename + " has unsupported tile compression " + std::to_string(tileCompression) + ", only gzip and none are supported");
+
+	readDirectory(rootDirOffset, rootDirLength, 0);
+
+	// Entries in each directory are sorted, and leaves are listed in order,
+	// so this is normally a no-op.
+	std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.tileId < b.tileId; });
+}
+
+std::string PMTiles::readSection(uint64_t offset, uint64_t length) {
+	if (offset + length > size)
+		throw std::runtime_error(filename + " is truncated (section at " + std::to_string(offset) + " extends past end of file)");
+
+	if (internalCompression == PMTILES_COMPRESSION_NONE)
+		return std::string(data + offset, length);
+
+	if (internalCompression == PMTILES_COMPRESSION_GZIP) {
+		std::string rv;
+		decompress_string(rv, data + offset, length, true);
+		return rv;
+	}
+
+	throw std::runtime_error(filename + " has unsupported internal compression " + std::to_string(internalCompression));
+}
+
+void PMTiles::readDirectory(uint64_t offset, uint64_t length, int depth) {
+	if (depth > PMTILES_MAX_DIRECTORY_DEPTH)
+		throw std::runtime_error(filename + " has too deeply nested leaf directories");
+
+	std::string directory = readSection(offset, length);
+	const char* p = directory.data();
+	const char* end = p + directory.size();
+
+	uint64_t numEntries = protozero::decode_varint(&p, end);
+	std::vector<Entry> dir(numEntries);
+
+	uint64_t lastId = 0;
+	for (auto& entry : dir) {
+		lastId += protozero::decode_varint(&p, end);
+		entry.tileId = lastId;
+	}
+
+	for (auto& entry : dir)
+		entry.runLength = protozero::decode_varint(&p, end);
+
+	for (auto& entry : dir)
+		entry.length = protozero::decode_varint(&p, end);
+
+	for (size_t i = 0; i < dir.size(); i++) {
+		uint64_t value = protozero::decode_varint(&p, end);
+		// 0 means "immediately after the previous entry"
+		if (value == 0 && i > 0)
+			dir[i].offset = dir[i - 1].offset + dir[i - 1].length;
+		else
+			dir[i].offset = value - 1;
+	}
+
+	for (auto& entry : dir) {
+		// A run length of 0 marks a pointer to a leaf directory.
+		if (entry.runLength == 0) {
+			readDirectory(leafDirsOffset + entry.offset, entry.length, depth + 1);
+			continue;
+		}
+
+		entry.offset += tileDataOffset;
+		if (entry.offset + entry.length > size)
+			throw std::runtime_error(filename + " is truncated (tile " + std::to_string(entry.tileId) + " extends past end of file)");
+
+		entries.push_back(entry);
+	}
+}
+
+std::vector<std::pair<std::string, std::string>> PMTiles::readMetadata() {
+	std::vector<std::pair<std::string, std::string>> rv;
+
+	// Present the archive's metadata the way an MBTiles file would: the JSON
+	// blob (which carries vector_layers) goes under `json`, and the zooms
+	// come from the header.
+	rv.push_back(std::make_pair("format", "pbf"));
+	rv.push_back(std::make_pair("minzoom", std::to_string(minZoom)));
+	rv.push_back(std::make_pair("maxzoom", std::to_string(maxZoom)));
+	if (metadataLength > 0)
+		rv.push_back(std::make_pair("json", readSection(metadataOffset, metadataLength)));
+
+	return rv;
+}
+
+void PMTiles::readBoundingBox(double &minLon, double &maxLon, double &minLat, double &maxLat) {
+	minLon = this->minLon;
+	maxLon = this->maxLon;
+	minLat = this->minLat;
+	maxLat = this->maxLat;
+}
+
+void PMTiles::populateTiles(bool verbose, std::vector<PreciseTileCoordinatesSet>& zooms, std::vector<Bbox>& extents) {
+	size_t tiles = 0;
+
+	for (const auto& entry : entries) {
+		// Mirror MBTiles::populateTiles, which skips gzipped empty tiles.
+		if (entry.length == 20)
+			continue;
+
+		for (uint64_t i = 0; i < entry.runLength; i++) {
+			uint8_t z;
+			uint32_t x, y;
+			tileIdToZxy(entry.tileId + i, z, x, y);
+
+			if (z >= zooms.size())
+				continue;
+
+			// PMTiles is XYZ; everything else in tile-smush is TMS.
+			uint32_t row = (1 << z) - 1 - y;
+
+			tiles++;
+			zooms[z].set(x, row);
+
+			if (x > extents[z].maxX) extents[z].maxX = x;
+			if (x < extents[z].minX) extents[z].minX = x;
+			if (row > extents[z].maxY) extents[z].maxY = row;
+			if (row < extents[z].minY) extents[z].minY = row;
+		}
+	}
+
+	if (verbose)
+		std::cout << filename << " had " << std::to_string(tiles) << " tiles" << std::endl;
+}
+
+protozero::data_view PMTiles::readTile(int zoom, int col, int row, std::vector<char>& buffer) {
+	uint64_t tileId = zxyToTileId(zoom, col, (1 << zoom) - 1 - row);
+
+	// Find the last run starting at or before tileId.
+	auto it = std::upper_bound(entries.begin(), entries.end(), tileId, [](uint64_t id, const Entry& entry) { return id < entry.tileId; });
+	if (it == entries.begin())
+		return {};
+
+	--it;
+	if (tileId >= it->tileId + it->runLength)
+		return {};
+
+	return { data + it->offset, it->length };
+}
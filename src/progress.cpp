@@ -0,0 +1,130 @@
+#include "progress.h"
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sys/stat.h>
+
+using namespace std;
+
+#define PROGRESS_STATUS_PREFIX "./progress."
+
+static std::string formatDuration(double seconds) {
+	uint64_t s = seconds;
+	char buf[32];
+	if (s >= 3600)
+		snprintf(buf, sizeof(buf), "%" PRIu64 "h%02" PRIu64 "m%02" PRIu64 "s", s / 3600, (s / 60) % 60, s % 60);
+	else if (s >= 60)
+		snprintf(buf, sizeof(buf), "%" PRIu64 "m%02" PRIu64 "s", s / 60, s % 60);
+	else
+		snprintf(buf, sizeof(buf), "%" PRIu64 "s", s);
+	return buf;
+}
+
+Progress::Progress(uint64_t shards, uint64_t shard, double interval):
+	shards(shards),
+	shard(shard),
+	interval(interval),
+	start(std::chrono::steady_clock::now()),
+	nextReport(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(interval))),
+	startTime(time(NULL)),
+	zoom(0),
+	planned(0),
+	done(0),
+	bytesOut(0),
+	finished(false)
+{
+}
+
+void Progress::setPlanned(uint64_t tiles) {
+	planned = tiles;
+	if (shards > 1)
+		writeStatus();
+}
+
+void Progress::setZoom(int zoom) {
+	this->zoom = zoom;
+}
+
+void Progress::writeStatus() {
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::string filename = PROGRESS_STATUS_PREFIX + std::to_string(shard);
+
+	// Write then rename, so shard 0 never sees a partial file.
+	{
+		std::ofstream out(filename + ".tmp");
+		out << zoom << " " << planned << " " << done << " " << bytesOut << " " << elapsed << " " << finished << std::endl;
+	}
+	rename((filename + ".tmp").c_str(), filename.c_str());
+}
+
+void Progress::print(int zoom, uint64_t planned, uint64_t done, double tilesPerSecond, double bytesPerSecond) {
+	double percent = planned > 0 ? 100.0 * done / planned : 100;
+	std::string eta = tilesPerSecond > 0 && planned > done ? formatDuration((planned - done) / tilesPerSecond) : "-";
+
+	char buf[256];
+	snprintf(buf, sizeof(buf), "progress: z%d %" PRIu64 "/%" PRIu64 " tiles (%.1f%%) %.0f tiles/s %.1f MB/s eta %s",
+		zoom, done, planned, percent, tilesPerSecond, bytesPerSecond / 1e6, eta.c_str());
+	std::cout << buf << std::endl;
+}
+
+void Progress::report() {
+	auto now = std::chrono::steady_clock::now();
+	nextReport = now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(interval));
+	double elapsed = std::chrono::duration<double>(now - start).count();
+
+	if (shards == 1) {
+		print(zoom, planned, done, done / elapsed, bytesOut / elapsed);
+		return;
+	}
+
+	writeStatus();
+
+	// Add up every shard's status. Shards run at their own pace, so sum
+	// their rates rather than dividing by our own elapsed time. Only the
+	// lowest-numbered shard that hasn't finished prints them, so the totals
+	// keep coming until the last shard is done.
+	bool reporting = true;
+	int minZoom = -1;
+	uint64_t totalPlanned = 0, totalDone = 0;
+	double tilesPerSecond = 0, bytesPerSecond = 0;
+	for (uint64_t i = 0; i < shards; i++) {
+		std::string filename = PROGRESS_STATUS_PREFIX + std::to_string(i);
+		int shardZoom;
+		uint64_t shardPlanned, shardDone, shardBytes;
+		double shardElapsed;
+		bool shardFinished = false;
+		struct stat st;
+		bool found = stat(filename.c_str(), &st) == 0 && st.st_mtime >= startTime;
+		if (found) {
+			std::ifstream in(filename);
+			found = (bool)(in >> shardZoom >> shardPlanned >> shardDone >> shardBytes >> shardElapsed >> shardFinished);
+		}
+
+		// A shard we haven't heard from yet is still running.
+		if (i < shard && !shardFinished)
+			reporting = false;
+		if (!found)
+			continue;
+
+		totalPlanned += shardPlanned;
+		totalDone += shardDone;
+		if (shardElapsed > 0) {
+			tilesPerSecond += shardDone / shardElapsed;
+			bytesPerSecond += shardBytes / shardElapsed;
+		}
+
+		// Report the zoom of the shard that's furthest behind.
+		if (shardDone < shardPlanned && (minZoom == -1 || shardZoom < minZoom))
+			minZoom = shardZoom;
+	}
+
+	if (reporting)
+		print(minZoom == -1 ? zoom : minZoom, totalPlanned, totalDone, tilesPerSecond, bytesPerSecond);
+}
+
+void Progress::finish() {
+	finished = true;
+	report();
+}
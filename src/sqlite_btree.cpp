@@ -0,0 +1,400 @@
+#include "sqlite_btree.h"
+#include "helpers.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+using namespace std;
+
+// B-trees this deep would need more rows than a file can hold; anything
+// deeper is a loop in a corrupt file.
+#define BTREE_MAX_DEPTH 20
+
+#define BTREE_INDEX_INTERIOR 0x02
+#define BTREE_TABLE_INTERIOR 0x05
+#define BTREE_INDEX_LEAF 0x0A
+#define BTREE_TABLE_LEAF 0x0D
+
+static uint64_t readBigEndian(const uint8_t* p, int bytes) {
+	uint64_t rv = 0;
+	for (int i = 0; i < bytes; i++)
+		rv = (rv << 8) | p[i];
+	return rv;
+}
+
+// SQLite's varints are big-endian, with 7 bits per byte except for the
+// ninth, which contributes all 8.
+static uint64_t readVarint(const uint8_t*& p, const uint8_t* end) {
+	uint64_t rv = 0;
+	for (int i = 0; i < 8; i++) {
+		if (p >= end)
+			throw std::runtime_error("truncated varint");
+		uint8_t c = *p++;
+		rv = (rv << 7) | (c & 0x7F);
+		if (!(c & 0x80))
+			return rv;
+	}
+
+	if (p >= end)
+		throw std::runtime_error("truncated varint");
+	return (rv << 8) | *p++;
+}
+
+static uint64_t serialTypeSize(uint64_t type) {
+	switch (type) {
+		case 0: case 8: case 9: return 0;
+		case 1: return 1;
+		case 2: return 2;
+		case 3: return 3;
+		case 4: return 4;
+		case 5: return 6;
+		case 6: case 7: return 8;
+		case 10: case 11: throw std::runtime_error("reserved serial type " + std::to_string(type));
+	}
+
+	// Blobs are even and text is odd.
+	return (type - 12) / 2;
+}
+
+static bool isIntegerType(uint64_t type) {
+	return (type >= 1 && type <= 6) || type == 8 || type == 9;
+}
+
+static int64_t readInteger(uint64_t type, const uint8_t* p) {
+	if (type == 8) return 0;
+	if (type == 9) return 1;
+
+	int bytes = serialTypeSize(type);
+	int shift = 64 - bytes * 8;
+	return (int64_t)(readBigEndian(p, bytes) << shift) >> shift;
+}
+
+// Decode the first `count` columns of an index record, which must all be
+// integers.
+static void decodeIntegers(const uint8_t* record, uint64_t size, int64_t* values, int count) {
+	const uint8_t* end = record + size;
+	const uint8_t* p = record;
+	uint64_t headerSize = readVarint(p, end);
+	if (headerSize > size)
+		throw std::runtime_error("record header is larger than its record");
+
+	const uint8_t* headerEnd = record + headerSize;
+	const uint8_t* body = headerEnd;
+	for (int i = 0; i < count; i++) {
+		if (p >= headerEnd)
+			throw std::runtime_error("record has too few columns");
+
+		uint64_t type = readVarint(p, headerEnd);
+		if (!isIntegerType(type))
+			throw std::runtime_error("index column isn't an integer");
+		if (body + serialTypeSize(type) > end)
+			throw std::runtime_error("record is truncated");
+
+		values[i] = readInteger(type, body);
+		body += serialTypeSize(type);
+	}
+}
+
+SqliteBtreeReader::SqliteBtreeReader():
+	fd(-1),
+	data(NULL),
+	size(0)
+{
+}
+
+SqliteBtreeReader::~SqliteBtreeReader() {
+	if (data)
+		munmap((void*)data, size);
+
+	if (fd != -1)
+		close(fd);
+}
+
+void SqliteBtreeReader::open(const std::string& filename, uint32_t tilesRoot, uint32_t indexRoot, int tileDataColumn) {
+	this->filename = filename;
+	this->tilesRoot = tilesRoot;
+	this->indexRoot = indexRoot;
+	this->tileDataColumn = tileDataColumn;
+
+	fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd == -1)
+		throw std::runtime_error("unable to open " + filename);
+
+	size = getFileSize(filename);
+	if (size < 100)
+		throw std::runtime_error(filename + " is too small to be a SQLite database");
+
+	void* mapped = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	if (mapped == MAP_FAILED)
+		throw std::runtime_error("unable to mmap " + filename);
+	data = (const uint8_t*)mapped;
+
+	if (memcmp(data, "SQLite format 3", 16) != 0)
+		throw std::runtime_error(filename + " is not a SQLite database");
+
+	pageSize = readBigEndian(data + 16, 2);
+	if (pageSize == 1)
+		pageSize = 65536;
+	if (pageSize < 512 || (pageSize & (pageSize - 1)) != 0)
+		throw std::runtime_error(filename + " has an invalid page size");
+
+	usableSize = pageSize - data[20];
+}
+
+const uint8_t* SqliteBtreeReader::page(uint32_t number) const {
+	if (number == 0 || (uint64_t)number * pageSize > size)
+		throw std::runtime_error(filename + ": page " + std::to_string(number) + " is out of range");
+
+	return data + (uint64_t)(number - 1) * pageSize;
+}
+
+SqliteBtreeReader::Payload SqliteBtreeReader::cellPayload(uint64_t totalSize, const uint8_t* local, const uint8_t* end, bool tableLeaf) const {
+	// How much of a payload is kept on the page, per "Cell Payload Overflow
+	// Pages" in the file format docs.
+	uint64_t u = usableSize;
+	uint64_t maxLocal = tableLeaf ? u - 35 : ((u - 12) * 64 / 255) - 23;
+
+	Payload rv;
+	rv.local = local;
+	rv.totalSize = totalSize;
+	rv.localSize = totalSize;
+	rv.overflowPage = 0;
+
+	if (totalSize > maxLocal) {
+		uint64_t minLocal = ((u - 12) * 32 / 255) - 23;
+		uint64_t k = minLocal + ((totalSize - minLocal) % (u - 4));
+		rv.localSize = k <= maxLocal ? k : minLocal;
+		if (local + rv.localSize + 4 > end)
+			throw std::runtime_error(filename + " has a cell that runs off its page");
+		rv.overflowPage = readBigEndian(local + rv.localSize, 4);
+	} else if (local + totalSize > end) {
+		throw std::runtime_error(filename + " has a cell that runs off its page");
+	}
+
+	return rv;
+}
+
+// Compare an index cell's (zoom_level, tile_column, tile_row) to key, and
+// return its rowid.
+void SqliteBtreeReader::compareIndexCell(const uint8_t* cell, const uint8_t* end, bool leaf, const int64_t* key, int& cmp, int64_t& rowid) const {
+	const uint8_t* p = cell;
+	if (!leaf)
+		p += 4;
+
+	uint64_t payloadSize = readVarint(p, end);
+	Payload payload = cellPayload(payloadSize, p, end, false);
+
+	// Index keys are four small integers, so they're never long enough to
+	// spill onto an overflow page.
+	if (payload.localSize != payload.totalSize)
+		throw std::runtime_error(filename + " has an index key on an overflow page");
+
+	int64_t values[4];
+	decodeIntegers(payload.local, payload.localSize, values, 4);
+	cmp = 0;
+	for (int i = 0; i < 3 && cmp == 0; i++)
+		cmp = values[i] < key[i] ? -1 : values[i] > key[i] ? 1 : 0;
+
+	rowid = values[3];
+}
+
+bool SqliteBtreeReader::findRowid(int64_t zoom, int64_t col, int64_t row, int64_t& rowid) const {
+	const int64_t key[3] = { zoom, col, row };
+	uint32_t pageNumber = indexRoot;
+
+	for (int depth = 0; depth < BTREE_MAX_DEPTH; depth++) {
+		const uint8_t* p = page(pageNumber);
+		const uint8_t* header = pageNumber == 1 ? p + 100 : p;
+		const uint8_t* end = p + usableSize;
+
+		uint8_t type = header[0];
+		if (type != BTREE_INDEX_INTERIOR && type != BTREE_INDEX_LEAF)
+			throw std::runtime_error(filename + ": page " + std::to_string(pageNumber) + " isn't an index page");
+
+		bool leaf = type == BTREE_INDEX_LEAF;
+		uint32_t cells = readBigEndian(header + 3, 2);
+		const uint8_t* pointers = header + (leaf ? 8 : 12);
+		if (pointers + cells * 2 > end)
+			throw std::runtime_error(filename + ": page " + std::to_string(pageNumber) + " has too many cells");
+
+		// Find the first cell whose key is at or after the one we want. Unlike
+		// a table, an index's interior cells hold keys of their own.
+		uint32_t lo = 0, hi = cells;
+		while (lo < hi) {
+			uint32_t mid = (lo + hi) / 2;
+			const uint8_t* cell = p + readBigEndian(pointers + mid * 2, 2);
+			if (cell >= end)
+				throw std::runtime_error(filename + ": page " + std::to_string(pageNumber) + " has a bad cell pointer");
+
+			int cmp;
+			int64_t cellRowid;
+			compareIndexCell(cell, end, leaf, key, cmp, cellRowid);
+			if (cmp == 0) {
+				rowid = cellRowid;
+				return true;
+			}
+
+			if (cmp < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		if (leaf)
+			return false;
+
+		if (lo < cells)
+			pageNumber = readBigEndian(p + readBigEndian(pointers + lo * 2, 2), 4);
+		else
+			pageNumber = readBigEndian(header + 8, 4);
+	}
+
+	throw std::runtime_error(filename + ": index is deeper than " + std::to_string(BTREE_MAX_DEPTH) + " pages");
+}
+
+bool SqliteBtreeReader::findRecord(int64_t rowid, Payload& payload) const {
+	uint32_t pageNumber = tilesRoot;
+
+	for (int depth = 0; depth < BTREE_MAX_DEPTH; depth++) {
+		const uint8_t* p = page(pageNumber);
+		const uint8_t* header = pageNumber == 1 ? p + 100 : p;
+		const uint8_t* end = p + usableSize;
+
+		uint8_t type = header[0];
+		if (type != BTREE_TABLE_INTERIOR && type != BTREE_TABLE_LEAF)
+			throw std::runtime_error(filename + ": page " + std::to_string(pageNumber) + " isn't a table page");
+
+		bool leaf = type == BTREE_TABLE_LEAF;
+		uint32_t cells = readBigEndian(header + 3, 2);
+		const uint8_t* pointers = header + (leaf ? 8 : 12);
+		if (pointers + cells * 2 > end)
+			throw std::runtime_error(filename + ": page " + std::to_string(pageNumber) + " has too many cells");
+
+		// Find the first cell whose rowid is at or after the one we want.
+		// Interior cells are a left child and the largest rowid in it; leaf
+		// cells are a payload size, a rowid and the payload.
+		uint32_t lo = 0, hi = cells;
+		while (lo < hi) {
+			uint32_t mid = (lo + hi) / 2;
+			const uint8_t* cell = p + readBigEndian(pointers + mid * 2, 2);
+			if (cell >= end)
+				throw std::runtime_error(filename + ": page " + std::to_string(pageNumber) + " has a bad cell pointer");
+
+			const uint8_t* q = cell;
+			if (leaf)
+				readVarint(q, end);
+			else
+				q += 4;
+			int64_t cellRowid = (int64_t)readVarint(q, end);
+
+			if (cellRowid < rowid)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		if (leaf) {
+			if (lo == cells)
+				return false;
+
+			const uint8_t* q = p + readBigEndian(pointers + lo * 2, 2);
+			uint64_t payloadSize = readVarint(q, end);
+			if ((int64_t)readVarint(q, end) != rowid)
+				return false;
+
+			payload = cellPayload(payloadSize, q, end, true);
+			return true;
+		}
+
+		if (lo < cells)
+			pageNumber = readBigEndian(p + readBigEndian(pointers + lo * 2, 2), 4);
+		else
+			pageNumber = readBigEndian(header + 8, 4);
+	}
+
+	throw std::runtime_error(filename + ": table is deeper than " + std::to_string(BTREE_MAX_DEPTH) + " pages");
+}
+
+bool SqliteBtreeReader::readTile(int zoom, int col, int row, protozero::data_view& tile, std::vector<char>& buffer) const {
+	int64_t rowid;
+	if (!findRowid(zoom, col, row, rowid))
+		return false;
+
+	Payload payload;
+	if (!findRecord(rowid, payload))
+		throw std::runtime_error(filename + ": index refers to a missing row");
+
+	// The record's header lists each column's serial type; tile_data starts
+	// after the columns before it.
+	const uint8_t* p = payload.local;
+	const uint8_t* headerEnd = payload.local + payload.localSize;
+	uint64_t headerSize = readVarint(p, headerEnd);
+	if (headerSize > payload.localSize)
+		throw std::runtime_error(filename + ": record header spills onto an overflow page");
+	headerEnd = payload.local + headerSize;
+
+	uint64_t offset = headerSize;
+	uint64_t type = 0;
+	for (int i = 0; i <= tileDataColumn; i++) {
+		if (p >= headerEnd)
+			throw std::runtime_error(filename + ": record has too few columns");
+
+		type = readVarint(p, headerEnd);
+		if (i < tileDataColumn)
+			offset += serialTypeSize(type);
+	}
+
+	if (type < 12 || type % 2 != 0)
+		throw std::runtime_error(filename + ": tile_data isn't a blob");
+
+	uint64_t length = serialTypeSize(type);
+	if (offset + length > payload.totalSize)
+		throw std::runtime_error(filename + ": record is truncated");
+
+	if (offset + length <= payload.localSize) {
+		tile = protozero::data_view((const char*)payload.local + offset, length);
+		return true;
+	}
+
+	buffer.resize(length);
+	copyPayload(payload, offset, length, buffer.data());
+	tile = protozero::data_view(buffer.data(), length);
+	return true;
+}
+
+void SqliteBtreeReader::copyPayload(const Payload& payload, uint64_t offset, uint64_t length, char* out) const {
+	if (offset < payload.localSize) {
+		uint64_t n = std::min(length, payload.localSize - offset);
+		memcpy(out, payload.local + offset, n);
+		out += n;
+		offset += n;
+		length -= n;
+	}
+
+	// The rest is on the overflow pages, each of which starts with the
+	// number of the next one.
+	offset = offset > payload.localSize ? offset - payload.localSize : 0;
+	uint64_t perPage = usableSize - 4;
+	uint32_t next = payload.overflowPage;
+	uint64_t pages = 0;
+	while (length > 0) {
+		if (next == 0 || ++pages > size / pageSize)
+			throw std::runtime_error(filename + " has a broken overflow chain");
+
+		const uint8_t* p = page(next);
+		next = readBigEndian(p, 4);
+		if (offset >= perPage) {
+			offset -= perPage;
+			continue;
+		}
+
+		uint64_t n = std::min(length, perPage - offset);
+		memcpy(out, p + 4 + offset, n);
+		out += n;
+		length -= n;
+		offset = 0;
+	}
+}
@@ -0,0 +1,410 @@
+#include "stats.h"
+#include "helpers.h"
+#include <algorithm>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unistd.h>
+
+using namespace std;
+
+bool stageTimingEnabled = false;
+bool stageTracingEnabled = false;
+
+struct TraceEvent {
+	uint64_t start;
+	uint64_t duration;
+	Stage stage;
+};
+
+struct ThreadStats {
+	StageCounters counters;
+	Histogram histograms[STAGE_COUNT];
+
+	// Grows to TRACE_BUFFER_EVENTS spans, then is a ring buffer: the next
+	// span goes in trace[traced % size].
+	std::vector<TraceEvent> trace;
+	uint64_t traced = 0;
+};
+
+// Every thread's stats, kept alive after their threads exit. The mutex is
+// only taken when a thread records its first span.
+static std::mutex registryMutex;
+static std::vector<std::shared_ptr<ThreadStats>> registry;
+
+Histogram::Histogram():
+	buckets(HISTOGRAM_BUCKETS),
+	count_(0),
+	max_(0)
+{
+}
+
+static size_t bucketIndex(uint64_t value) {
+	const uint64_t subBuckets = 1 << HISTOGRAM_SUB_BUCKET_BITS;
+	if (value < subBuckets)
+		return value;
+
+	int msb = 63 - __builtin_clzll(value);
+	int shift = msb - HISTOGRAM_SUB_BUCKET_BITS;
+	return ((msb - HISTOGRAM_SUB_BUCKET_BITS + 1) << HISTOGRAM_SUB_BUCKET_BITS) + ((value >> shift) & (subBuckets - 1));
+}
+
+// The largest value that falls into bucket i.
+static uint64_t bucketLimit(size_t i) {
+	const uint64_t subBuckets = 1 << HISTOGRAM_SUB_BUCKET_BITS;
+	if (i < subBuckets)
+		return i;
+
+	int shift = (i >> HISTOGRAM_SUB_BUCKET_BITS) - 1;
+	uint64_t lower = (subBuckets + (i & (subBuckets - 1))) << shift;
+	return lower + ((1ull << shift) - 1);
+}
+
+void Histogram::record(uint64_t value) {
+	buckets[bucketIndex(value)]++;
+	count_++;
+	if (value > max_)
+		max_ = value;
+}
+
+void Histogram::merge(const Histogram& other) {
+	for (size_t i = 0; i < buckets.size(); i++)
+		buckets[i] += other.buckets[i];
+	count_ += other.count_;
+	max_ = std::max(max_, other.max_);
+}
+
+uint64_t Histogram::percentile(double q) const {
+	if (count_ == 0)
+		return 0;
+
+	uint64_t rank = std::max<uint64_t>(1, std::ceil(q * count_));
+	uint64_t seen = 0;
+	for (size_t i = 0; i < buckets.size(); i++) {
+		seen += buckets[i];
+		if (seen >= rank)
+			return std::min(bucketLimit(i), max_);
+	}
+
+	return max_;
+}
+
+const char* stageName(Stage stage) {
+	switch (stage) {
+		case Stage::IndexBuild: return "index_build";
+		case Stage::Read: return "read";
+		case Stage::Decompress: return "decompress";
+		case Stage::Merge: return "merge";
+		case Stage::Compress: return "compress";
+		case Stage::QueueWait: return "queue_wait";
+		case Stage::Write: return "write";
+		case Stage::Flush: return "flush";
+		case Stage::LockWait: return "lock_wait";
+		case Stage::MemoryWait: return "memory_wait";
+		case Stage::TileStats: return "tilestats";
+		case Stage::Filter: return "filter";
+	}
+
+	return "unknown";
+}
+
+static ThreadStats& threadStats() {
+	thread_local std::shared_ptr<ThreadStats> stats;
+	if (!stats) {
+		stats = std::make_shared<ThreadStats>();
+
+		std::lock_guard<std::mutex> lock(registryMutex);
+		registry.push_back(stats);
+	}
+
+	return *stats;
+}
+
+StageCounters& threadStageCounters() {
+	return threadStats().counters;
+}
+
+StageTimer::StageTimer(Stage stage, uint64_t* elapsed):
+	stage(stage),
+	enabled(stageTimingEnabled || stageTracingEnabled),
+	elapsed(elapsed)
+{
+	if (enabled)
+		start = std::chrono::steady_clock::now();
+}
+
+StageTimer::~StageTimer() {
+	if (!enabled)
+		return;
+
+	auto end = std::chrono::steady_clock::now();
+	uint64_t duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+	ThreadStats& stats = threadStats();
+	stats.counters.nanoseconds[(int)stage] += duration;
+	stats.counters.calls[(int)stage]++;
+	stats.histograms[(int)stage].record(duration);
+	if (elapsed)
+		*elapsed += duration;
+
+	if (stageTracingEnabled) {
+		uint64_t startNs = std::chrono::duration_cast<std::chrono::nanoseconds>(start.time_since_epoch()).count();
+		if (stats.trace.size() < TRACE_BUFFER_EVENTS)
+			stats.trace.push_back({ startNs, duration, stage });
+		else
+			stats.trace[stats.traced % stats.trace.size()] = { startNs, duration, stage };
+		stats.traced++;
+	}
+}
+
+static std::string formatSeconds(double seconds) {
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.6f", seconds);
+	return buf;
+}
+
+static std::string histogramJson(const Histogram& histogram) {
+	return "{ \"count\": " + std::to_string(histogram.count()) +
+		", \"p50\": " + std::to_string(histogram.percentile(0.5)) +
+		", \"p99\": " + std::to_string(histogram.percentile(0.99)) +
+		", \"p999\": " + std::to_string(histogram.percentile(0.999)) +
+		", \"max\": " + std::to_string(histogram.max()) + " }";
+}
+
+static std::vector<std::shared_ptr<ThreadStats>> registeredThreads() {
+	std::lock_guard<std::mutex> lock(registryMutex);
+	return registry;
+}
+
+// Durations of one stage, across every thread.
+static Histogram stageHistogram(const std::vector<std::shared_ptr<ThreadStats>>& threads, int stage) {
+	Histogram rv;
+	for (const auto& stats : threads)
+		rv.merge(stats->histograms[stage]);
+	return rv;
+}
+
+static std::string stagesJson(const StageCounters& counters, const std::string& indent) {
+	std::string json = "{";
+	bool first = true;
+	for (int i = 0; i < STAGE_COUNT; i++) {
+		if (counters.calls[i] == 0)
+			continue;
+
+		json += first ? "\n" : ",\n";
+		json += indent + "\t\"" + stageName((Stage)i) + "\": { \"seconds\": " + formatSeconds(counters.nanoseconds[i] / 1e9) +
+			", \"calls\": " + std::to_string(counters.calls[i]) + " }";
+		first = false;
+	}
+	json += first ? "}" : "\n" + indent + "}";
+	return json;
+}
+
+static void printPercentiles(const std::string& label, const Histogram& histogram, double scale, const char* unit) {
+	if (histogram.count() == 0)
+		return;
+
+	char buf[256];
+	snprintf(buf, sizeof(buf), "%-24s p50=%.1f%s p99=%.1f%s p999=%.1f%s max=%.1f%s n=%" PRIu64,
+		label.c_str(),
+		histogram.percentile(0.5) / scale, unit,
+		histogram.percentile(0.99) / scale, unit,
+		histogram.percentile(0.999) / scale, unit,
+		histogram.max() / scale, unit,
+		histogram.count());
+	std::cout << buf << std::endl;
+}
+
+void printLatencyReport(const std::vector<ZoomStats>& zooms) {
+	for (size_t zoom = 0; zoom < zooms.size(); zoom++) {
+		const ZoomStats& stats = zooms[zoom];
+		std::string prefix = "z" + std::to_string(zoom) + " ";
+		printPercentiles(prefix + "read", stats.readNanoseconds, 1e3, "us");
+		printPercentiles(prefix + "merge+compress", stats.mergeNanoseconds, 1e3, "us");
+		printPercentiles(prefix + "tile size", stats.tileBytes, 1, "B");
+	}
+
+	std::vector<std::shared_ptr<ThreadStats>> threads = registeredThreads();
+	for (int i = 0; i < STAGE_COUNT; i++)
+		printPercentiles(stageName((Stage)i), stageHistogram(threads, i), 1e3, "us");
+}
+
+void printIoReport(const std::vector<IoCounters>& io) {
+	for (const auto& entry : io) {
+		if (entry.values.empty())
+			continue;
+
+		std::cout << "io " << entry.name << ":";
+		for (const auto& value : entry.values)
+			std::cout << " " << value.first << "=" << std::to_string(value.second);
+		std::cout << std::endl;
+	}
+}
+
+static double percentOf(uint64_t part, uint64_t whole) {
+	return whole == 0 ? 0 : 100.0 * part / whole;
+}
+
+void printQueueReport(const std::vector<QueueStats>& queues) {
+	char buf[256];
+	for (const auto& queue : queues) {
+		snprintf(buf, sizeof(buf), "queue %s: capacity=%" PRIu64 " mean=%.1f p99=%" PRIu64 " empty=%.1f%% full=%.1f%% blocked_pushes=%" PRIu64 " blocked_pops=%" PRIu64,
+			queue.name.c_str(), queue.capacity,
+			queue.samples == 0 ? 0.0 : (double)queue.occupancySum / queue.samples,
+			queue.occupancy.percentile(0.99),
+			percentOf(queue.emptySamples, queue.samples),
+			percentOf(queue.fullSamples, queue.samples),
+			queue.blockedPushes, queue.blockedPops);
+		std::cout << buf << std::endl;
+	}
+}
+
+void writeStatsReport(const std::string& filename, uint64_t shards, uint64_t shard, double wallSeconds, const std::vector<ZoomStats>& zooms, const std::vector<IoCounters>& io, const std::vector<QueueStats>& queues) {
+	StageCounters total;
+	std::vector<std::shared_ptr<ThreadStats>> threads = registeredThreads();
+
+	for (const auto& stats : threads) {
+		for (int i = 0; i < STAGE_COUNT; i++) {
+			total.nanoseconds[i] += stats->counters.nanoseconds[i];
+			total.calls[i] += stats->counters.calls[i];
+		}
+	}
+
+	std::string json = "{\n";
+	json += "\t\"shards\": " + std::to_string(shards) + ",\n";
+	json += "\t\"shard\": " + std::to_string(shard) + ",\n";
+	json += "\t\"wall_seconds\": " + formatSeconds(wallSeconds) + ",\n";
+	json += "\t\"stages\": " + stagesJson(total, "\t") + ",\n";
+
+	json += "\t\"threads\": [";
+	for (size_t i = 0; i < threads.size(); i++) {
+		json += i == 0 ? "\n" : ",\n";
+		json += "\t\t" + stagesJson(threads[i]->counters, "\t\t");
+	}
+	json += threads.empty() ? "],\n" : "\n\t],\n";
+
+	// Latency percentiles of each stage, in nanoseconds.
+	json += "\t\"stage_latency\": {";
+	bool first = true;
+	for (int i = 0; i < STAGE_COUNT; i++) {
+		Histogram histogram = stageHistogram(threads, i);
+		if (histogram.count() == 0)
+			continue;
+
+		json += first ? "\n" : ",\n";
+		json += std::string("\t\t\"") + stageName((Stage)i) + "\": " + histogramJson(histogram);
+		first = false;
+	}
+	json += first ? "},\n" : "\n\t},\n";
+
+	ZoomStats totals;
+	json += "\t\"zooms\": [";
+	first = true;
+	for (size_t zoom = 0; zoom < zooms.size(); zoom++) {
+		const ZoomStats& stats = zooms[zoom];
+		if (stats.singleSourceTiles == 0 && stats.multiSourceTiles == 0)
+			continue;
+
+		totals.singleSourceTiles += stats.singleSourceTiles;
+		totals.multiSourceTiles += stats.multiSourceTiles;
+		totals.bytesIn += stats.bytesIn;
+		totals.bytesOut += stats.bytesOut;
+
+		json += first ? "\n" : ",\n";
+		json += "\t\t{ \"zoom\": " + std::to_string(zoom) +
+			", \"single_source_tiles\": " + std::to_string(stats.singleSourceTiles) +
+			", \"multi_source_tiles\": " + std::to_string(stats.multiSourceTiles) +
+			", \"bytes_in\": " + std::to_string(stats.bytesIn) +
+			", \"bytes_out\": " + std::to_string(stats.bytesOut);
+		if (stats.readNanoseconds.count() > 0)
+			json += ",\n\t\t\t\"read_ns\": " + histogramJson(stats.readNanoseconds);
+		if (stats.mergeNanoseconds.count() > 0)
+			json += ",\n\t\t\t\"merge_ns\": " + histogramJson(stats.mergeNanoseconds);
+		if (stats.tileBytes.count() > 0)
+			json += ",\n\t\t\t\"tile_bytes\": " + histogramJson(stats.tileBytes);
+		json += " }";
+		first = false;
+	}
+	json += first ? "],\n" : "\n\t],\n";
+
+	json += "\t\"totals\": { \"single_source_tiles\": " + std::to_string(totals.singleSourceTiles) +
+		", \"multi_source_tiles\": " + std::to_string(totals.multiSourceTiles) +
+		", \"bytes_in\": " + std::to_string(totals.bytesIn) +
+		", \"bytes_out\": " + std::to_string(totals.bytesOut) + " },\n";
+
+	json += "\t\"io\": [";
+	for (size_t i = 0; i < io.size(); i++) {
+		json += i == 0 ? "\n" : ",\n";
+		json += "\t\t{ \"name\": " + escapeJsonString(io[i].name) + ", \"counters\": {";
+		for (size_t j = 0; j < io[i].values.size(); j++) {
+			json += j == 0 ? " " : ", ";
+			json += escapeJsonString(io[i].values[j].first) + ": " + std::to_string(io[i].values[j].second);
+		}
+		json += " } }";
+	}
+	json += io.empty() ? "],\n" : "\n\t],\n";
+
+	// Occupancy is in tiles; empty and full are the fraction of samples.
+	json += "\t\"queues\": [";
+	for (size_t i = 0; i < queues.size(); i++) {
+		const QueueStats& queue = queues[i];
+		json += i == 0 ? "\n" : ",\n";
+		json += "\t\t{ \"name\": " + escapeJsonString(queue.name) +
+			", \"capacity\": " + std::to_string(queue.capacity) +
+			", \"samples\": " + std::to_string(queue.samples) +
+			", \"mean\": " + formatSeconds(queue.samples == 0 ? 0 : (double)queue.occupancySum / queue.samples) +
+			", \"empty\": " + formatSeconds(percentOf(queue.emptySamples, queue.samples) / 100) +
+			", \"full\": " + formatSeconds(percentOf(queue.fullSamples, queue.samples) / 100) +
+			", \"blocked_pushes\": " + std::to_string(queue.blockedPushes) +
+			", \"blocked_pops\": " + std::to_string(queue.blockedPops) +
+			",\n\t\t\t\"occupancy\": " + histogramJson(queue.occupancy) + " }";
+	}
+	json += queues.empty() ? "]\n" : "\n\t]\n";
+	json += "}\n";
+
+	std::ofstream out(filename);
+	out << json;
+	out.close();
+	if (!out)
+		throw std::runtime_error("unable to write stats to " + filename);
+}
+
+void writeTraceReport(const std::string& filename, uint64_t shard) {
+	std::vector<std::shared_ptr<ThreadStats>> threads = registeredThreads();
+
+	std::ofstream out(filename);
+	int pid = getpid();
+
+	// Timestamps come from the monotonic clock, so traces from several
+	// shards on one machine line up when their events are combined.
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"args\":{\"name\":\"shard " << shard << "\"}}";
+
+	char buf[256];
+	for (size_t tid = 0; tid < threads.size(); tid++) {
+		const ThreadStats& stats = *threads[tid];
+		out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << tid <<
+			",\"args\":{\"name\":\"" << (tid == 0 ? "main" : "thread " + std::to_string(tid)) << "\"}}";
+
+		if (stats.traced > stats.trace.size())
+			std::cerr << "trace: thread " << std::to_string(tid) << " dropped its " << std::to_string(stats.traced - stats.trace.size()) << " oldest spans" << std::endl;
+
+		uint64_t first = stats.traced > stats.trace.size() ? stats.traced - stats.trace.size() : 0;
+		for (uint64_t i = first; i < stats.traced; i++) {
+			const TraceEvent& event = stats.trace[i % stats.trace.size()];
+			snprintf(buf, sizeof(buf), ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f}",
+				stageName(event.stage), pid, tid, event.start / 1e3, event.duration / 1e3);
+			out << buf;
+		}
+	}
+
+	out << "\n]}\n";
+	out.close();
+	if (!out)
+		throw std::runtime_error("unable to write trace to " + filename);
+}
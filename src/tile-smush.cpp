@@ -10,11 +10,34 @@
 #include <thread>
 #include <deque>
 #include <map>
+#include <memory>
+#include <algorithm>
+#include <cstring>
+#include <chrono>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <mutex>
 
 // Tilemaker code
 #include "helpers.h"
 #include "tile_coordinates_set.h"
 #include "mbtiles.h"
+#include "pmtiles.h"
+#include "directory_tiles.h"
+#include "tile_stream.h"
+#include "stats.h"
+#include "progress.h"
+#include "bounded_queue.h"
+#include "memory_budget.h"
+#include "numa.h"
+#include "arena.h"
+#include "layer_tile_builder.h"
+#include "json.h"
+#include "tilestats.h"
+#include "layer_filter.h"
+#include "layer_merge.h"
+#include "tile_budget.h"
 
 #include <vtzero/builder.hpp>
 
@@ -32,13 +55,266 @@ bool verbose = false;
 
 thread_local std::vector<std::shared_ptr<MBTiles>> tlsTiles;
 
+// What we spent (and saved) on compression at one zoom.
+struct CompressionStats {
+	uint64_t tiles = 0;
+	uint64_t bytesIn = 0;
+	uint64_t bytesOut = 0;
+	double cpuSeconds = 0;
+};
+
 struct Input {
 	uint16_t index;
 	std::string filename;
-	MBTiles mbtiles;
+	std::shared_ptr<TileSource> source;
 	std::vector<PreciseTileCoordinatesSet> zooms;
 	std::vector<Bbox> bbox;
+
+	// What /proc/self/io counted while this input was indexed.
+	std::vector<std::pair<std::string, int64_t>> indexIo;
+
+	// The layers to keep, and what to call them.
+	LayerFilter filter;
+
+	// The tilestats from the input's own metadata, if they cover all of its
+	// layers. Otherwise its tiles are scanned as they're merged.
+	TileStats tileStats;
+	bool scanTiles = true;
+};
+
+// Whether an input's tilestats describe every layer in its vector_layers.
+bool tileStatsCoverLayers(const JsonValue& tilestats, const JsonValue& vectorLayers) {
+	const JsonValue* layers = tilestats.get("layers");
+	if (!layers)
+		return false;
+
+	for (const auto& vectorLayer : vectorLayers.array) {
+		const JsonValue* id = vectorLayer.get("id");
+		if (!id)
+			return false;
+
+		bool found = false;
+		for (const auto& layer : layers->array) {
+			const JsonValue* name = layer.get("layer");
+			if (name && name->string == id->string)
+				found = true;
+		}
+		if (!found)
+			return false;
+	}
+	return true;
+}
+
+// The smallest box covering every input's tiles at a zoom.
+Bbox zoomExtent(const std::vector<std::shared_ptr<Input>>& inputs, int zoom) {
+	Bbox bbox = inputs[0]->bbox[zoom];
+	for (const auto& input : inputs) {
+		if (input->bbox[zoom].minX < bbox.minX) bbox.minX = input->bbox[zoom].minX;
+		if (input->bbox[zoom].minY < bbox.minY) bbox.minY = input->bbox[zoom].minY;
+		if (input->bbox[zoom].maxX > bbox.maxX) bbox.maxX = input->bbox[zoom].maxX;
+		if (input->bbox[zoom].maxY > bbox.maxY) bbox.maxY = input->bbox[zoom].maxY;
+	}
+	return bbox;
+}
+
+// The number of tiles this shard will write, i.e. the tiles present in at
+// least one input.
+uint64_t countPlannedTiles(const std::vector<std::shared_ptr<Input>>& inputs, uint64_t shards, uint64_t shard, uint64_t numaNodes) {
+	uint64_t planned = 0;
+	for (int zoom = 0; zoom < 15; zoom++) {
+		Bbox bbox = zoomExtent(inputs, zoom);
+		for (int x = bbox.minX; x <= bbox.maxX; x++) {
+			for (int y = bbox.minY; y <= bbox.maxY; y++) {
+				if (tileShard(zoom, x, y, shards, numaNodes) != shard)
+					continue;
+
+				for (const auto& input : inputs) {
+					if (input->zooms[zoom].test(x, y)) {
+						planned++;
+						break;
+					}
+				}
+			}
+		}
+	}
+	return planned;
+}
+
+bool isMBTilesInput(const std::string& filename) {
+	return filename != TILE_STREAM_FILENAME && !isDirectory(filename) && !ends_with(filename, ".pmtiles");
+}
+
+// Pick a reader based on the file extension; `-` is a record stream on stdin,
+// directories are z/x/y.pbf trees, and anything else that isn't a PMTiles
+// archive is assumed to be MBTiles.
+std::shared_ptr<TileSource> openInput(std::string& filename, unsigned int ioThreads, const MBTilesReadOptions& readOptions) {
+	std::shared_ptr<TileSource> source;
+	if (filename == TILE_STREAM_FILENAME)
+		source = std::make_shared<TileStream>();
+	else if (isDirectory(filename))
+		source = std::make_shared<DirectoryTiles>(ioThreads);
+	else if (ends_with(filename, ".pmtiles"))
+		source = std::make_shared<PMTiles>(readOptions.readAhead);
+	else
+		source = std::make_shared<MBTiles>(readOptions);
+
+	source->openForReading(filename);
+	return source;
+}
+
+// Likewise for the output: `-` is a record stream on stdout, and anything
+// that isn't an .mbtiles file is written as a z/x/y.pbf directory tree.
+std::shared_ptr<TileSink> openOutput(std::string& filename, unsigned int ioThreads) {
+	std::shared_ptr<TileSink> sink;
+	if (filename == TILE_STREAM_FILENAME)
+		sink = std::make_shared<TileStream>();
+	else if (ends_with(filename, ".mbtiles"))
+		sink = std::make_shared<MBTiles>();
+	else if (ends_with(filename, ".pmtiles"))
+		throw std::runtime_error("writing PMTiles is not supported: " + filename);
+	else
+		sink = std::make_shared<DirectoryTiles>(ioThreads);
+
+	sink->openForWriting(filename);
+	return sink;
+}
+
+// A tile on its way through the pipeline.
+struct TileJob {
+	int zoom;
+	int x;
+	int y;
+	size_t sources = 0;
+
+	// The compressed tile from each matching input, as read.
+	std::vector<std::string> inputs;
+	// The same tiles, decompressed.
+	std::vector<std::string> tiles;
+	// The uncompressed output tile, then the compressed one.
+	std::string merged;
+	std::string output;
+
+	// A single-source tile that's already in the output codec is copied as-is.
+	bool passthrough = false;
+	// Whether each input's tile is to be scanned for tilestats, and its
+	// input's layer filter (or NULL).
+	std::vector<bool> scan;
+	std::vector<const LayerFilter*> filters;
+	// The filters dropped every layer, so there's nothing to write.
+	bool dropped = false;
+
+	uint64_t bytesIn = 0;
+	std::vector<uint64_t> readNanoseconds;
+	uint64_t mergeNanoseconds = 0;
+	double compressCpuSeconds = 0;
+
+	// What's currently charged to memoryBudget for this job.
+	int64_t charged = 0;
+
+	int64_t footprint() const {
+		int64_t bytes = merged.size() + output.size();
+		for (const auto& input : inputs)
+			bytes += input.size();
+		for (const auto& tile : tiles)
+			bytes += tile.size();
+		return bytes;
+	}
+};
+
+// Charge or release the difference between what a job holds now and what it
+// held when it was last charged.
+void rechargeJob(TileJob& job) {
+	int64_t bytes = job.footprint();
+	if (bytes > job.charged)
+		memoryBudget.charge(bytes - job.charged);
+	else if (bytes < job.charged)
+		memoryBudget.release(job.charged - bytes);
+	job.charged = bytes;
+}
+
+typedef BoundedQueue<std::unique_ptr<TileJob>> TileQueue;
+
+// How many threads each CPU-bound stage gets, and how many tiles can wait
+// between stages. Reading and writing always get one thread each, since a
+// SQLite connection must only be used by one thread at a time.
+struct PipelineOptions {
+	unsigned int decompressThreads = 1;
+	unsigned int mergeThreads = 1;
+	unsigned int compressThreads = 0; // i.e. half of the shard's cores
+	size_t queueDepth = 256;
+};
+
+// Parse e.g. decompress=2,merge=1,compress=4.
+bool parsePipelineThreads(std::string spec, PipelineOptions& options) {
+	for (auto& stage : split_string(spec, ',')) {
+		size_t equals = stage.find('=');
+		if (equals == std::string::npos)
+			return false;
+
+		std::string name = stage.substr(0, equals);
+		int threads = atoi(stage.c_str() + equals + 1);
+		if (threads < 1)
+			return false;
+
+		if (name == "decompress")
+			options.decompressThreads = threads;
+		else if (name == "merge")
+			options.mergeThreads = threads;
+		else if (name == "compress")
+			options.compressThreads = threads;
+		else
+			return false;
+	}
+	return true;
+}
+
+// The first exception thrown by any stage. Failing aborts every queue, so
+// that the other stages stop rather than wait forever.
+struct PipelineFailure {
+	std::mutex mutex;
+	std::exception_ptr error;
+	std::vector<TileQueue*> queues;
+
+	void fail(std::exception_ptr e) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!error)
+				error = e;
+		}
+		for (auto queue : queues)
+			queue->abort();
+		memoryBudget.cancel();
+	}
 };
+
+// Start `threads` threads that each take jobs from `in`, do `work` on them and
+// pass them on to `out`, closing `out` once `in` runs dry. `work` is also told
+// which of the stage's threads it's on. What each job holds afterwards is
+// charged to memoryBudget.
+//
+// With `nodes`, each thread is pinned to one of them, dealt out round-robin
+// across every stage's threads.
+void startStage(std::vector<std::thread>& running, unsigned int threads, TileQueue& in, TileQueue& out, PipelineFailure& failure, const std::vector<NumaNode>& nodes, std::function<void(TileJob&, unsigned int)> work) {
+	for (unsigned int i = 0; i < threads; i++) {
+		const NumaNode* node = nodes.empty() ? NULL : &nodes[running.size() % nodes.size()];
+		running.push_back(std::thread([&in, &out, &failure, work, i, node]() {
+			if (node && !bindToNumaNode(*node))
+				std::cout << "note: couldn't bind a thread to NUMA node " << std::to_string(node->id) << std::endl;
+			try {
+				std::unique_ptr<TileJob> job;
+				while (in.pop(job)) {
+					work(*job, i);
+					rechargeJob(*job);
+					if (!out.push(std::move(job)))
+						break;
+				}
+			} catch (...) {
+				failure.fail(std::current_exception());
+			}
+			out.close();
+		}));
+	}
+}
 /**
  *\brief The Main function is responsible for command line processing, loading data and starting worker threads.
  *
@@ -47,6 +323,15 @@ struct Input {
  * Worker threads write the output tiles, and start in the outputProc function.
  */
 int main(const int argc, const char* argv[]) {
+	auto startTime = std::chrono::steady_clock::now();
+
+	// When tiles are streamed to stdout, everything we'd normally print
+	// goes to stderr instead.
+	for (int i = 1; i + 1 < argc; i++) {
+		if ((strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "--output") == 0) && strcmp(argv[i + 1], TILE_STREAM_FILENAME) == 0)
+			std::cout.rdbuf(std::cerr.rdbuf());
+	}
+
 	uint64_t shards = 1;
 	uint64_t shard = 0;
 
@@ -66,19 +351,276 @@ int main(const int argc, const char* argv[]) {
 	}
 
 
+	std::string MergedFilename("merged.mbtiles");
+	TileCompression outputCompression = TileCompression::Gzip;
+	std::vector<int> compressionLevels(15, 6);
+	bool recompress = false;
+	MBTilesReadOptions readOptions;
+	int64_t readCacheMiB = 0;
+	int64_t memoryLimitMiB = 0;
+	bool numa = false;
+	bool scanTileStats = true;
+	bool mergeLayers = false;
+	bool inputPrecedence = false;
+	TileBudget tileBudget;
+	std::string statsFilename;
+	std::string traceFilename;
+	double progressInterval = 0;
+	PipelineOptions pipelineOptions;
 	std::vector<std::string> filenames;
+	// Layer filters apply to the input that follows them.
+	LayerFilter filter;
+	std::vector<LayerFilter> filters;
 	for (int i = 1; i < argc; i++) {
-		filenames.push_back(std::string(argv[i]));
+		std::string arg(argv[i]);
+		if ((arg == "-o" || arg == "--output") && i + 1 < argc) {
+			MergedFilename = argv[++i];
+			continue;
+		}
+
+		if (arg == "--compression" && i + 1 < argc) {
+			if (!parse_compression(argv[++i], outputCompression)) {
+				std::cerr << "fatal: --compression must be one of gzip, zlib or none" << std::endl;
+				return 1;
+			}
+			continue;
+		}
+
+		if (arg == "--level" && i + 1 < argc) {
+			if (!parse_zoom_levels(argv[++i], compressionLevels)) {
+				std::cerr << "fatal: --level must be a level from 0 to 12, or a schedule like 0-8:12,9-12:9,13-14:4" << std::endl;
+				return 1;
+			}
+			continue;
+		}
+
+		if (arg == "--read-mmap") {
+			readOptions.mmap = true;
+			continue;
+		}
+
+		if (arg == "--read-cache" && i + 1 < argc) {
+			readCacheMiB = atoll(argv[++i]);
+			if (readCacheMiB <= 0) {
+				std::cerr << "fatal: --read-cache must be a number of MiB" << std::endl;
+				return 1;
+			}
+			continue;
+		}
+
+		if (arg == "--read-ahead") {
+			readOptions.readAhead = true;
+			continue;
+		}
+
+		if (arg == "--threads" && i + 1 < argc) {
+			if (!parsePipelineThreads(argv[++i], pipelineOptions)) {
+				std::cerr << "fatal: --threads must be like decompress=2,merge=1,compress=4" << std::endl;
+				return 1;
+			}
+			continue;
+		}
+
+		if (arg == "--queue-depth" && i + 1 < argc) {
+			int depth = atoi(argv[++i]);
+			if (depth < 1) {
+				std::cerr << "fatal: --queue-depth must be a number of tiles" << std::endl;
+				return 1;
+			}
+			pipelineOptions.queueDepth = depth;
+			continue;
+		}
+
+		if (arg == "--max-tile-bytes" && i + 1 < argc) {
+			long long maxTileBytes = atoll(argv[++i]);
+			if (maxTileBytes <= 0) {
+				std::cerr << "fatal: --max-tile-bytes must be a number of bytes" << std::endl;
+				return 1;
+			}
+			tileBudget.maxBytes = maxTileBytes;
+			continue;
+		}
+
+		if (arg == "--layer-priority" && i + 1 < argc) {
+			std::string priorities = argv[++i];
+			for (const auto& layer : split_string(priorities, ','))
+				tileBudget.priorities.push_back(layer);
+			continue;
+		}
+
+		if (arg == "--memory-limit" && i + 1 < argc) {
+			memoryLimitMiB = atoll(argv[++i]);
+			if (memoryLimitMiB <= 0) {
+				std::cerr << "fatal: --memory-limit must be a number of MiB" << std::endl;
+				return 1;
+			}
+			continue;
+		}
+
+		if (arg == "--numa") {
+			numa = true;
+			continue;
+		}
+
+		if (arg == "--no-tilestats") {
+			scanTileStats = false;
+			continue;
+		}
+
+		if (arg == "--merge-layers") {
+			mergeLayers = true;
+			continue;
+		}
+
+		if (arg == "--input-precedence") {
+			inputPrecedence = true;
+			continue;
+		}
+
+		if (arg == "--read-btree") {
+			readOptions.directBtree = true;
+			continue;
+		}
+
+		if (arg == "--stats" && i + 1 < argc) {
+			statsFilename = argv[++i];
+			continue;
+		}
+
+		if (arg == "--trace" && i + 1 < argc) {
+			traceFilename = argv[++i];
+			continue;
+		}
+
+		if (arg == "--progress" && i + 1 < argc) {
+			progressInterval = atof(argv[++i]);
+			if (progressInterval <= 0) {
+				std::cerr << "fatal: --progress must be a number of seconds" << std::endl;
+				return 1;
+			}
+			continue;
+		}
+
+		if (arg == "--include" && i + 1 < argc) {
+			filter.includes.push_back(argv[++i]);
+			continue;
+		}
+
+		if (arg == "--exclude" && i + 1 < argc) {
+			filter.excludes.push_back(argv[++i]);
+			continue;
+		}
+
+		if (arg == "--rename" && i + 1 < argc) {
+			std::string rename = argv[++i];
+			size_t equals = rename.find('=');
+			if (equals == std::string::npos || equals == 0 || equals + 1 == rename.size()) {
+				std::cerr << "fatal: --rename must be like from=to" << std::endl;
+				return 1;
+			}
+			filter.renames.push_back(std::make_pair(rename.substr(0, equals), rename.substr(equals + 1)));
+			continue;
+		}
+
+		if (arg == "--recompress") {
+			recompress = true;
+			continue;
+		}
+
+		// Every option has been handled by now, so this is either one that's
+		// missing its value or one we don't know. "-" alone is stdin.
+		if (arg.size() > 1 && arg[0] == '-') {
+			std::cerr << "fatal: " << arg << (i + 1 == argc ? " is missing its value or isn't an option" : " isn't an option") << std::endl;
+			return 1;
+		}
+
+		filenames.push_back(arg);
+		filters.push_back(filter);
+		filter = LayerFilter();
 		if (false && shard == 0)
 			std::cout << "arg " << std::to_string(i) << ": " << filenames.back() << std::endl;
 	}
 
+	if (!filter.empty()) {
+		std::cerr << "fatal: --include, --exclude and --rename must come before the input they apply to" << std::endl;
+		return 1;
+	}
+
 	if (filenames.empty()) {
 		if (shard == 0)
-			std::cerr << "usage: ./tile-smush file1.mbtiles file2.mbtiles [...]" << std::endl;
+			std::cerr << "usage: ./tile-smush [--output merged.mbtiles|dir|-] [--compression gzip|zlib|none] [--level 0-12|z1-z2:level,...] [--recompress] [--read-mmap] [--read-cache MiB] [--read-ahead] [--read-btree] [--threads decompress=N,merge=N,compress=N] [--queue-depth tiles] [--memory-limit MiB] [--numa] [--no-tilestats] [--merge-layers] [--input-precedence] [--max-tile-bytes bytes] [--layer-priority layer,...] [--stats stats.json] [--trace trace.json] [--progress seconds] [--include glob] [--exclude glob] [--rename from=to] file1.mbtiles [...] file2.pmtiles dir - [...]" << std::endl;
 		return 1;
 	}
 
+	if (shards > 1 && std::find(filenames.begin(), filenames.end(), TILE_STREAM_FILENAME) != filenames.end()) {
+		std::cerr << "fatal: can't read a tile stream from stdin with more than one shard" << std::endl;
+		return 1;
+	}
+
+	if (!statsFilename.empty()) {
+		stageTimingEnabled = true;
+		// Every shard writes its own report.
+		if (shards > 1)
+			statsFilename += "." + std::to_string(shard);
+	}
+
+	if (!traceFilename.empty()) {
+		stageTracingEnabled = true;
+		if (shards > 1)
+			traceFilename += "." + std::to_string(shard);
+	}
+
+	// The shards of one run share their output and RUN_ID (which
+	// tile-smush-parallel sets), which tells their tilestats files apart
+	// from any an earlier run left behind. Our own from such a run goes now.
+	std::string shardRun;
+	if (shards > 1) {
+		shardRun = MergedFilename;
+		if (getenv("RUN_ID") != NULL)
+			shardRun += " " + std::string(getenv("RUN_ID"));
+		clearShardTileStats(shard);
+	}
+
+	// Filesystem-heavy backends (directory trees) fan their I/O out across
+	// threads. Split the cores between the shard processes.
+	unsigned int ioThreads = std::max<unsigned int>(1, std::thread::hardware_concurrency() / shards);
+
+	// When sharded, put this shard, and so every thread it starts, on one
+	// NUMA node before anything is read, so that its page cache and heap are
+	// local, and size its threads from that node's share of the cores. Every
+	// shard sees the same topology, so they agree on how tiles are split
+	// between nodes. A single process instead pins its pipeline's threads
+	// to the nodes in turn.
+	uint64_t numaNodes = 1;
+	std::vector<NumaNode> workerNodes;
+	if (numa) {
+		std::vector<NumaNode> topology = readNumaTopology();
+		if (topology.size() <= 1) {
+			std::cout << "note: only one NUMA node, ignoring --numa" << std::endl;
+		} else if (shards == 1) {
+			workerNodes = topology;
+			std::cout << "numa: pipeline threads spread over " << std::to_string(topology.size()) << " nodes" << std::endl;
+		} else {
+			numaNodes = std::min<uint64_t>(topology.size(), shards);
+			const NumaNode& node = topology[shard % topology.size()];
+			if (!bindToNumaNode(node))
+				std::cout << "note: couldn't bind to NUMA node " << std::to_string(node.id) << std::endl;
+			uint64_t nodeShards = (shards - shard % topology.size() + topology.size() - 1) / topology.size();
+			ioThreads = std::max<unsigned int>(1, node.cpus.size() / nodeShards);
+			std::cout << "numa: shard " << std::to_string(shard) << " on node " << std::to_string(node.id) <<
+				" (" << std::to_string(node.cpus.size()) << " cpus, " << std::to_string(nodeShards) << " shards)" << std::endl;
+		}
+	}
+
+	// Compression is usually the most expensive stage, so by default it gets
+	// half of this shard's cores.
+	if (pipelineOptions.compressThreads == 0)
+		pipelineOptions.compressThreads = std::max<unsigned int>(1, ioThreads / 2);
+
+	// Like --read-cache, --memory-limit is shared between the shards.
+	if (memoryLimitMiB > 0)
+		memoryBudget.setLimit(memoryLimitMiB * 1024 * 1024 / shards);
+
 	// See https://github.com/xerial/sqlite-jdbc/issues/59#issuecomment-162115704
 	int rv;
 	rv = sqlite3_config(SQLITE_CONFIG_MEMSTATUS, 0);
@@ -87,21 +629,40 @@ int main(const int argc, const char* argv[]) {
 		return 1;
 	}
 
-	// We only use a single thread, so tell SQLite to skip its internal locking.
-	// See https://www.sqlite.org/c3ref/c_config_covering_index_scan.html#sqliteconfigsinglethread
-	rv = sqlite3_config(SQLITE_CONFIG_SINGLETHREAD);
+	// The pipeline reads on one thread and writes on another, but never
+	// shares a connection between them, so SQLite only needs to lock its
+	// global state, not each connection.
+	// See https://www.sqlite.org/c3ref/c_config_covering_index_scan.html#sqliteconfigmultithread
+	rv = sqlite3_config(SQLITE_CONFIG_MULTITHREAD);
 	if (rv) {
-		std::cerr << "fatal: sqlite3_config(SQLITE_CONFIG_SINGLETHREAD)=" << std::to_string(rv) << std::endl;
+		std::cerr << "fatal: sqlite3_config(SQLITE_CONFIG_MULTITHREAD)=" << std::to_string(rv) << std::endl;
 		return 1;
 	}
 
+	// --read-cache is a budget for all MBTiles inputs, split between them in
+	// proportion to their size. Each shard is its own process, so each gets
+	// its share of the budget.
+	uint64_t mbtilesBytes = 0;
+	for (const auto& filename : filenames)
+		if (isMBTilesInput(filename))
+			mbtilesBytes += getFileSize(filename);
+
 	std::vector<std::shared_ptr<Input>> inputs;
 	for (auto filename : filenames) {
+		StageTimer timer(Stage::IndexBuild);
+		std::vector<std::pair<std::string, int64_t>> ioBefore;
+		if (stageTimingEnabled)
+			ioBefore = readProcessIo();
+
 		std::shared_ptr<Input> input = std::make_shared<Input>();
 		input->filename = filename;
 		input->index = inputs.size();
+		input->filter = filters[input->index];
 		inputs.push_back(input);
-		input->mbtiles.openForReading(filename);
+		MBTilesReadOptions inputReadOptions = readOptions;
+		if (readCacheMiB > 0 && mbtilesBytes > 0 && isMBTilesInput(filename))
+			inputReadOptions.cacheKiB = std::max<int64_t>(1, readCacheMiB * 1024 / shards * getFileSize(filename) / mbtilesBytes);
+		input->source = openInput(filename, ioThreads, inputReadOptions);
 		input->zooms.reserve(15);
 		for (int zoom = 0; zoom < 15; zoom++) {
 			input->zooms.push_back(PreciseTileCoordinatesSet(zoom));
@@ -113,199 +674,478 @@ int main(const int argc, const char* argv[]) {
 			});
 		}
 
-		input->mbtiles.populateTiles(shard == 0, input->zooms, input->bbox);
+		input->source->populateTiles(shard == 0, input->zooms, input->bbox);
+		if (stageTimingEnabled)
+			input->indexIo = ioDelta(ioBefore, readProcessIo());
 	}
 
-	std::string MergedFilename("merged.mbtiles");
-
-	if (shards == 1) {
+	if (shards == 1 && ends_with(MergedFilename, ".mbtiles")) {
 		// When we're running on the entire dataset, remove the merged.mbtiles file.
 		// Otherwise, we rely on tile-smush-parallel to do this.
 		remove(MergedFilename.c_str());
 	}
 
-	MBTiles merged;
-	merged.openForWriting(MergedFilename);
+	std::shared_ptr<TileSink> merged = openOutput(MergedFilename, ioThreads);
+
+	// Gather the metadata of every input now, though it's only written once
+	// the merge is done and the tilestats are known. Every shard does this,
+	// since whichever finishes last writes it.
+	// See https://github.com/mapbox/mbtiles-spec/blob/master/1.3/spec.md#content
+	double minLon = std::numeric_limits<double>::max(),
+				 maxLon = std::numeric_limits<double>::min(),
+				 minLat = std::numeric_limits<double>::max(),
+				 maxLat = std::numeric_limits<double>::min();
+	int minzoom = 100;
+	int maxzoom = 0;
+	double minLonCurrent, maxLonCurrent, minLatCurrent, maxLatCurrent;
 
-	if (shard == 0) {
-		// Populate the `metadata` table
-		// See https://github.com/mapbox/mbtiles-spec/blob/master/1.3/spec.md#content
+	std::map<std::string, std::string> metadata;
 
-		double minLon = std::numeric_limits<double>::max(),
-					 maxLon = std::numeric_limits<double>::min(),
-					 minLat = std::numeric_limits<double>::max(),
-					 maxLat = std::numeric_limits<double>::min();
-		int minzoom = 100;
-		int maxzoom = 0;
-		double minLonCurrent, maxLonCurrent, minLatCurrent, maxLatCurrent;
+	// You can have the same layer in several inputs, e.g. as hikeratlas
+	// does with its hacky parks/city_parks hijinks.
+	VectorLayers layers;
+	for (auto& input : inputs) {
+		for (const auto& entry : input->source->readMetadata()) {
+			metadata[entry.first] = entry.second;
 
-		std::map<std::string, std::string> metadata;
+			if (entry.first == "minzoom" || entry.first == "maxzoom") {
+				int zoom = atoi(entry.second.c_str());
 
-		// Use a map to dedupe. You can have _the exact same_ layer, e.g.
-		// as hikeratlas does with its hacky parks/city_parks hijinks.
-		std::map<std::string, std::string> layers;
-		for (auto& input : inputs) {
-			for (const auto& entry : input->mbtiles.readMetadata()) {
-				metadata[entry.first] = entry.second;
+				if (entry.first == "minzoom" && zoom < minzoom)
+					minzoom = zoom;
+				if (entry.first == "maxzoom" && zoom > maxzoom)
+					maxzoom = zoom;
+			}
 
-				if (entry.first == "minzoom" || entry.first == "maxzoom") {
-					int zoom = atoi(entry.second.c_str());
+			if (entry.first == "json") {
+				JsonValue json = parseJson(entry.second);
+				JsonValue* vectorLayers = json.get("vector_layers");
+				if (!vectorLayers || vectorLayers->type != JsonValue::Type::Array)
+					throw std::runtime_error("no vector_layers found for " + input->filename);
 
-					if (entry.first == "minzoom" && zoom < minzoom)
-						minzoom = zoom;
-					if (entry.first == "maxzoom" && zoom > maxzoom)
-						maxzoom = zoom;
-				}
+				input->filter.filterLayerList(*vectorLayers, "id");
+				layers.add(*vectorLayers);
 
-				if (entry.first == "json") {
-					// This is incredibly hacky! I don't want to learn how to use a C++ JSON
-					// library
-					const char* vectorLayers = strstr(entry.second.c_str(), "\"vector_layers\":[");
-					if (!vectorLayers) {
-						throw std::runtime_error("no vector_layers found for " + input->filename);
+				JsonValue* tilestats = json.get("tilestats");
+				JsonValue* tilestatsLayers = tilestats ? tilestats->get("layers") : NULL;
+				if (tilestatsLayers)
+					input->filter.filterLayerList(*tilestatsLayers, "layer");
+				if (tilestats && tileStatsCoverLayers(*tilestats, *vectorLayers)) {
+					try {
+						input->tileStats.addJson(*tilestats);
+						input->scanTiles = false;
+					} catch (std::runtime_error& e) {
+						if (shard == 0)
+							std::cout << "note: ignoring tilestats in " << input->filename << ": " << e.what() << std::endl;
+						input->tileStats = TileStats();
 					}
+				}
+			}
+		}
 
-					vectorLayers += strlen("\"vector_layers\":[");
-					//std::cout << "INPUT: " << vectorLayers << std::endl;
+		input->source->readBoundingBox(minLonCurrent, maxLonCurrent, minLatCurrent, maxLatCurrent);
 
-					const char* start = NULL;
-					// This is a total hack, it'll fail if you have braces in strings, e.g.
-					int braces = 0;
-					while(*vectorLayers != ']') {
-						if (start == NULL && *vectorLayers == ']')
-							break;
+		if (minLonCurrent < minLon) minLon = minLonCurrent;
+		if (minLatCurrent < minLat) minLat = minLatCurrent;
+		if (maxLonCurrent > maxLon) maxLon = maxLonCurrent;
+		if (maxLatCurrent > maxLat) maxLat = maxLatCurrent;
+	}
 
-						if (start == NULL && *vectorLayers == '{') {
-							start = vectorLayers;
-						}
+	metadata["bounds"] =
+		std::to_string(minLon) + "," +
+		std::to_string(minLat) + "," +
+		std::to_string(maxLon) + "," +
+		std::to_string(maxLat);
+	metadata["minzoom"] = std::to_string(minzoom);
+	metadata["maxzoom"] = std::to_string(maxzoom);
 
-						if (*vectorLayers == '{') {
-							braces++;
-						}
+	// Tilestats are only written if they cover every input, either from its
+	// metadata or by scanning its tiles.
+	bool tileStatsComplete = true;
+	for (const auto& input : inputs)
+		if (input->scanTiles && !scanTileStats)
+			tileStatsComplete = false;
 
-						if (*vectorLayers == '}') {
-							braces--;
-						}
+	std::unique_ptr<Progress> progress;
+	if (progressInterval > 0) {
+		progress.reset(new Progress(shards, shard, progressInterval));
+		progress->setPlanned(countPlannedTiles(inputs, shards, shard, numaNodes));
+	}
 
-						if (start && braces == 0) {
-							std::string layer(start, vectorLayers - start + 1);
-							//std::cout << "LAYER: " << layer << std::endl;
+	std::vector<std::pair<std::string, int64_t>> mergeIoBefore, numaBefore;
+	if (stageTimingEnabled) {
+		mergeIoBefore = readProcessIo();
+		numaBefore = readNumaCounters();
+	}
 
-							layers[layer] = "";
-							start = NULL;
-						}
+	std::vector<CompressionStats> compressionStats(15);
+	std::vector<ZoomStats> zoomStats(15);
 
-						vectorLayers++;
-					}
+	// Tiles flow from the reader (this thread) through decompress, merge and
+	// compress threads to a writer thread. Each queue is named after the stage
+	// that consumes it.
+	TileQueue decompressQueue(pipelineOptions.queueDepth, 1);
+	TileQueue mergeQueue(pipelineOptions.queueDepth, pipelineOptions.decompressThreads);
+	TileQueue compressQueue(pipelineOptions.queueDepth, pipelineOptions.mergeThreads);
+	TileQueue writeQueue(pipelineOptions.queueDepth, pipelineOptions.compressThreads);
+	std::vector<TileQueue*> queues = { &decompressQueue, &mergeQueue, &compressQueue, &writeQueue };
+	std::vector<QueueStats> queueStats(queues.size());
+	const char* queueNames[] = { "decompress", "merge", "compress", "write" };
+	for (size_t i = 0; i < queues.size(); i++) {
+		queueStats[i].name = queueNames[i];
+		queueStats[i].capacity = queues[i]->capacity();
+	}
+
+	PipelineFailure failure;
+	failure.queues = queues;
+	std::vector<std::thread> stages;
+
+	// Each merge thread scans tiles into its own tilestats.
+	std::vector<TileStats> mergeTileStats(pipelineOptions.mergeThreads);
+	std::vector<uint64_t> duplicateLayers(pipelineOptions.mergeThreads);
+
+	startStage(stages, pipelineOptions.decompressThreads, decompressQueue, mergeQueue, failure, workerNodes, [&](TileJob& job, unsigned int) {
+		bool passthrough = job.inputs.size() == 1 && !recompress && detect_compression(job.inputs[0].data(), job.inputs[0].size()) == outputCompression &&
+			(!tileBudget.enabled() || job.inputs[0].size() <= tileBudget.maxBytes);
+
+		// A passthrough tile is only decompressed to be filtered or scanned;
+		// unless the filter changed it, it's still written as it was read.
+		if (passthrough && !job.scan[0] && !job.filters[0]) {
+			job.passthrough = true;
+			return;
+		}
+
+		job.tiles.resize(job.inputs.size());
+		bool filtered = false;
+		bool empty = true;
+		for (size_t i = 0; i < job.inputs.size(); i++) {
+			{
+				StageTimer timer(Stage::Decompress, &job.mergeNanoseconds);
+				decompress_tile(job.tiles[i], job.inputs[i].data(), job.inputs[i].size());
+			}
+
+			if (job.filters[i]) {
+				StageTimer timer(Stage::Filter, &job.mergeNanoseconds);
+				thread_local std::string scratch;
+				if (job.filters[i]->filterTile(job.tiles[i], scratch)) {
+					job.tiles[i].swap(scratch);
+					filtered = true;
 				}
 			}
+			empty = empty && job.tiles[i].empty();
+		}
 
-			input->mbtiles.readBoundingBox(minLonCurrent, maxLonCurrent, minLatCurrent, maxLatCurrent);
+		job.passthrough = passthrough && !filtered;
+		if (filtered && empty) {
+			job.dropped = true;
+			job.tiles.clear();
+		}
+		if (!job.passthrough)
+			job.inputs.clear();
+	});
 
-			if (minLonCurrent < minLon) minLon = minLonCurrent;
-			if (minLatCurrent < minLat) minLat = minLatCurrent;
-			if (maxLonCurrent > maxLon) maxLon = maxLonCurrent;
-			if (maxLatCurrent > maxLat) maxLat = maxLatCurrent;
+	startStage(stages, pipelineOptions.mergeThreads, mergeQueue, compressQueue, failure, workerNodes, [&](TileJob& job, unsigned int thread) {
+		for (size_t i = 0; i < job.tiles.size(); i++) {
+			if (job.scan[i]) {
+				StageTimer timer(Stage::TileStats, &job.mergeNanoseconds);
+				mergeTileStats[thread].addTile(job.tiles[i]);
+			}
 		}
 
-		// Dump the metadata into merged.mbtiles
-		for (auto const& entry : metadata) {
-			merged.writeMetadata(entry.first, entry.second);
+		if (job.passthrough) {
+			job.tiles.clear();
+			return;
 		}
+		if (job.dropped)
+			return;
 
-		merged.writeMetadata(
-			"bounds", 
-			std::to_string(minLon) + "," +
-			std::to_string(minLat) + "," +
-			std::to_string(maxLon) + "," +
-			std::to_string(maxLat)
-		);
+		// A single tile only needs transcoding.
+		if (job.tiles.size() == 1) {
+			job.merged = std::move(job.tiles[0]);
+			job.tiles.clear();
+			return;
+		}
 
-		merged.writeMetadata("minzoom", std::to_string(minzoom));
-		merged.writeMetadata("maxzoom", std::to_string(maxzoom));
+		// Multiple inputs want to contribute a tile at this zxy. They'll all
+		// have disjoint layers, so concatenate their contents to form the
+		// new tile, unless asked to combine layers that share a name. Copies
+		// of the same layer are only kept once.
+		StageTimer timer(Stage::Merge, &job.mergeNanoseconds);
+		thread_local std::vector<vtzero::layer> layers;
+		layers.clear();
+		readTileLayers(job.tiles, layers);
+		duplicateLayers[thread] += dropDuplicateLayers(layers, inputPrecedence);
+		if (mergeLayers && mergeTileLayers(layers, job.merged)) {
+			job.tiles.clear();
+			return;
+		}
+		thread_local Arena arena;
+		arena.reset();
+		LayerTileBuilder<ArenaAllocator<vtzero::data_view>> builder{ArenaAllocator<vtzero::data_view>(arena)};
+		for (const auto& layer : layers)
+			builder.add_existing_layer(layer);
+		builder.serialize(job.merged);
+		job.tiles.clear();
+	});
 
-		std::string vector_layers = "{\"vector_layers\":[";
-		int i = 0;
-		for (auto const& entry : layers) {
-			if (i > 0)
-				vector_layers += ",";
+	// How many tiles each layer was dropped from to fit --max-tile-bytes, by
+	// zoom and layer, for each compress thread.
+	std::vector<std::map<std::pair<int, std::string>, uint64_t>> budgetDrops(pipelineOptions.compressThreads);
+	std::vector<uint64_t> overBudget(pipelineOptions.compressThreads);
 
-			vector_layers += entry.first;
-			i++;
+	startStage(stages, pipelineOptions.compressThreads, compressQueue, writeQueue, failure, workerNodes, [&](TileJob& job, unsigned int thread) {
+		if (job.passthrough) {
+			job.output = std::move(job.inputs[0]);
+			return;
 		}
+		if (job.dropped)
+			return;
 
-		vector_layers += "]}";
-		merged.writeMetadata("json", vector_layers);
-	}
-
-	std::vector<Input*> matching;
-	for (int zoom = 0; zoom < 15; zoom++) {
-		Bbox bbox = inputs[0]->bbox[zoom];
-		for (const auto& input : inputs) {
-			if (input->bbox[zoom].minX < bbox.minX) bbox.minX = input->bbox[zoom].minX;
-			if (input->bbox[zoom].minY < bbox.minY) bbox.minY = input->bbox[zoom].minY;
-			if (input->bbox[zoom].maxX > bbox.maxX) bbox.maxX = input->bbox[zoom].maxX;
-			if (input->bbox[zoom].maxY > bbox.maxY) bbox.maxY = input->bbox[zoom].maxY;
+		double start = getThreadCpuSeconds();
+		{
+			StageTimer timer(Stage::Compress, &job.mergeNanoseconds);
+			if (tileBudget.enabled()) {
+				thread_local std::vector<std::string> dropped;
+				dropped.clear();
+				bool fits = tileBudget.fit(job.merged, job.output, [&](const std::string& tile) {
+					return compress_tile(tile, outputCompression, compressionLevels[job.zoom]);
+				}, dropped);
+				if (!fits)
+					overBudget[thread]++;
+				for (const auto& layer : dropped)
+					budgetDrops[thread][std::make_pair(job.zoom, layer)]++;
+			} else {
+				job.output = compress_tile(job.merged, outputCompression, compressionLevels[job.zoom]);
+			}
 		}
+		job.compressCpuSeconds = getThreadCpuSeconds() - start;
+		std::string().swap(job.merged);
+	});
 
-		// std::cout << "z=" << std::to_string(zoom) << " minX=" << std::to_string(bbox.minX) << " minY=" << std::to_string(bbox.minY) << " maxX=" << std::to_string(bbox.maxX) << " maxY=" << std::to_string(bbox.maxY) << std::endl;
+	std::thread writer([&]() {
+		try {
+			int progressZoom = -1;
+			std::unique_ptr<TileJob> job;
+			while (writeQueue.pop(job)) {
+				ZoomStats& zoomStat = zoomStats[job->zoom];
+				if (!job->passthrough && !job->dropped) {
+					CompressionStats& stats = compressionStats[job->zoom];
+					stats.cpuSeconds += job->compressCpuSeconds;
+					stats.tiles++;
+					stats.bytesIn += job->bytesIn;
+					stats.bytesOut += job->output.size();
+				}
 
-		for (int x = bbox.minX; x <= bbox.maxX; x++) {
-			for (int y = bbox.minY; y <= bbox.maxY; y++) {
-				if ((x * (1 << zoom) + y) % shards != shard)
-					continue;
+				if (job->sources == 1)
+					zoomStat.singleSourceTiles++;
+				else
+					zoomStat.multiSourceTiles++;
+				zoomStat.bytesIn += job->bytesIn;
+				zoomStat.bytesOut += job->output.size();
+				if (stageTimingEnabled) {
+					for (uint64_t nanoseconds : job->readNanoseconds)
+						zoomStat.readNanoseconds.record(nanoseconds);
+					if (!job->passthrough)
+						zoomStat.mergeNanoseconds.record(job->mergeNanoseconds);
+					zoomStat.tileBytes.record(job->output.size());
+				}
 
-				matching.clear();
-				for (const auto& input : inputs) {
-					if (input->zooms[zoom].test(x, y))
-						matching.push_back(input.get());
+				if (!job->dropped)
+					merged->saveTile(job->zoom, job->x, job->y, &job->output, false);
+				memoryBudget.release(job->charged);
+				if (progress) {
+					if (job->zoom > progressZoom) {
+						progressZoom = job->zoom;
+						progress->setZoom(progressZoom);
+					}
+					progress->tileDone(job->output.size());
 				}
+			}
+		} catch (...) {
+			failure.fail(std::current_exception());
+		}
+	});
 
-				if (matching.empty())
-					continue;
+	// Sample how full each queue is, to show which stage holds the others up.
+	std::atomic<bool> sampling(true);
+	std::thread sampler([&]() {
+		while (sampling) {
+			for (size_t i = 0; i < queues.size(); i++)
+				queueStats[i].sample(queues[i]->size());
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	});
 
-				if (matching.size() == 1) {
-					// When exactly 1 mbtiles matches, it's a special case and we can
-					// copy directly between them.
-					std::vector<char> old = matching[0]->mbtiles.readTile(zoom, x, y);
-					std::string buffer(old.data(), old.size());
-					merged.saveTile(zoom, x, y, &buffer, false);
-					continue;
-				}
+	try {
+		std::vector<Input*> matching;
+		std::vector<char> readBuffer;
+		bool reading = true;
+		for (int zoom = 0; zoom < 15 && reading; zoom++) {
+			Bbox bbox = zoomExtent(inputs, zoom);
 
-				//std::cout << "need to merge z=" << std::to_string(zoom) << " x=" << std::to_string(x) << " y=" << std::to_string(y) << std::endl;
-				// Multiple mbtiles want to contribute a tile at this zxy.
-				// They'll all have disjoint layers, so decompress each tile
-				// and concatenate their contents to form the new tile.
+			// std::cout << "z=" << std::to_string(zoom) << " minX=" << std::to_string(bbox.minX) << " minY=" << std::to_string(bbox.minY) << " maxX=" << std::to_string(bbox.maxX) << " maxY=" << std::to_string(bbox.maxY) << std::endl;
 
-				vtzero::tile_builder builder;
+			for (int x = bbox.minX; x <= bbox.maxX && reading; x++) {
+				for (int y = bbox.minY; y <= bbox.maxY && reading; y++) {
+					if (tileShard(zoom, x, y, shards, numaNodes) != shard)
+						continue;
 
-				std::deque<std::string> strs;
-				for (auto& match : matching) {
-					std::vector<char> compressed = match->mbtiles.readTile(zoom, x, y);
+					matching.clear();
+					for (const auto& input : inputs) {
+						if (input->zooms[zoom].test(x, y))
+							matching.push_back(input.get());
+					}
 
-					std::string oldTile;
-					decompress_string(oldTile, compressed.data(), compressed.size(), true);
-					//std::cout << "compressed.size()=" << std::to_string(compressed.size()) << " oldTile.size()=" << std::to_string(oldTile.size()) << std::endl;
+					if (matching.empty())
+						continue;
 
-					strs.push_back(oldTile);
-					vtzero::vector_tile existingTile{strs.back()};
-					while (auto layer = existingTile.next_layer()) {
-						builder.add_existing_layer(layer);
-						std::string layerName(layer.name().data(), layer.name().size());
-						//std::cout << "adding layer=" << layerName << " features=" << std::to_string(layer.num_features()) << std::endl;
+					// The views readTile returns only last until the next read, so
+					// the job gets its own copy. This is where we wait when the
+					// memory budget is spent.
+					std::unique_ptr<TileJob> job(new TileJob());
+					job->zoom = zoom;
+					job->x = x;
+					job->y = y;
+					job->sources = matching.size();
+					for (auto& match : matching) {
+						protozero::data_view tile;
+						uint64_t readNanoseconds = 0;
+						{
+							StageTimer timer(Stage::Read, &readNanoseconds);
+							tile = match->source->readTile(zoom, x, y, readBuffer);
+						}
+						memoryBudget.acquire(tile.size(), job->charged);
+						job->charged += tile.size();
+						job->inputs.emplace_back(tile.data(), tile.size());
+						job->scan.push_back(scanTileStats && match->scanTiles);
+						job->filters.push_back(match->filter.empty() ? NULL : &match->filter);
+						job->bytesIn += tile.size();
+						if (stageTimingEnabled)
+							job->readNanoseconds.push_back(readNanoseconds);
 					}
-				}
 
-				std::string buffer;
-				builder.serialize(buffer);
-				std::string compressed = compress_string(buffer, 6, true);
-				merged.saveTile(zoom, x, y, &compressed, false);
+					reading = decompressQueue.push(std::move(job));
+				}
 			}
 		}
+	} catch (...) {
+		failure.fail(std::current_exception());
+	}
+	decompressQueue.close();
+
+	for (auto& stage : stages)
+		stage.join();
+	writer.join();
+	sampling = false;
+	sampler.join();
+
+	if (failure.error)
+		std::rethrow_exception(failure.error);
+
+	for (size_t i = 0; i < queues.size(); i++) {
+		queueStats[i].blockedPushes = queues[i]->blockedPushes();
+		queueStats[i].blockedPops = queues[i]->blockedPops();
+	}
+
+	for (int zoom = 0; zoom < compressionStats.size(); zoom++) {
+		const CompressionStats& stats = compressionStats[zoom];
+		if (stats.tiles == 0)
+			continue;
+
+		std::cout << "z" << std::to_string(zoom) << " level=" << std::to_string(compressionLevels[zoom]) <<
+			" compressed=" << std::to_string(stats.tiles) <<
+			" bytesIn=" << std::to_string(stats.bytesIn) <<
+			" bytesOut=" << std::to_string(stats.bytesOut) <<
+			" saved=" << std::to_string((int64_t)stats.bytesIn - (int64_t)stats.bytesOut) <<
+			" cpu=" << std::to_string(stats.cpuSeconds) << "s" << std::endl;
 	}
 
-	merged.closeForWriting();
+	printQueueReport(queueStats);
+	if (memoryBudget.getLimit() > 0)
+		std::cout << "memory: limit=" << std::to_string(memoryBudget.getLimit()) <<
+			" peak=" << std::to_string(memoryBudget.getPeak()) <<
+			" waits=" << std::to_string(memoryBudget.getWaits()) << std::endl;
+
+	std::map<std::pair<int, std::string>, uint64_t> drops;
+	for (const auto& threadDrops : budgetDrops)
+		for (const auto& drop : threadDrops)
+			drops[drop.first] += drop.second;
+	for (const auto& drop : drops)
+		std::cout << "z" << std::to_string(drop.first.first) << " layer " << drop.first.second <<
+			" dropped from " << std::to_string(drop.second) << " tiles to fit --max-tile-bytes" << std::endl;
+	uint64_t overBudgetTiles = 0;
+	for (uint64_t tiles : overBudget)
+		overBudgetTiles += tiles;
+	if (overBudgetTiles > 0)
+		std::cout << "note: " << std::to_string(overBudgetTiles) << " tiles with a single layer are still over --max-tile-bytes" << std::endl;
+
+	uint64_t duplicates = 0;
+	for (uint64_t dropped : duplicateLayers)
+		duplicates += dropped;
+	if (duplicates > 0)
+		std::cout << "duplicate layers: dropped=" << std::to_string(duplicates) << std::endl;
+
+	TileStats scanned;
+	for (const auto& stats : mergeTileStats)
+		scanned.merge(stats);
+
+	// Each shard only scans its own tiles, so the metadata is written by
+	// whichever shard finishes last, once it has all of them.
+	TileStats tileStats;
+	bool lastShard = true;
+	if (shards > 1) {
+		std::vector<uint64_t> otherRuns;
+		lastShard = combineShardTileStats(shards, shard, shardRun, scanned, tileStats, otherRuns);
+		for (uint64_t other : otherRuns)
+			std::cout << "warning: ./tilestats." << std::to_string(other) << " is from another run (check RUN_ID); the tilestats leave out that shard" << std::endl;
+	} else
+		tileStats = std::move(scanned);
+
+	if (lastShard) {
+		for (const auto& input : inputs)
+			tileStats.merge(input->tileStats);
+
+		for (auto const& entry : metadata)
+			merged->writeMetadata(entry.first, entry.second);
+
+		std::string json = "{\"vector_layers\":" + layers.toJson();
+		if (tileStatsComplete)
+			json += ",\"tilestats\":" + tileStats.toJson();
+		json += "}";
+		merged->writeMetadata("json", json);
+	}
+
+	merged->closeForWriting();
+
+	if (progress)
+		progress->finish();
+
+	if (!statsFilename.empty()) {
+		double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+		std::vector<IoCounters> io;
+		for (const auto& input : inputs) {
+			IoCounters counters { "input " + input->filename, input->source->ioCounters() };
+			for (const auto& entry : input->indexIo)
+				counters.values.push_back(std::make_pair("index_" + entry.first, entry.second));
+			io.push_back(counters);
+		}
+		io.push_back({ "output " + MergedFilename, merged->ioCounters() });
+		io.push_back({ "merge", ioDelta(mergeIoBefore, readProcessIo()) });
+		io.push_back({ "numa", ioDelta(numaBefore, readNumaCounters()) });
+		io.push_back({ "numa_pages", readNumaPages() });
+		io.push_back({ "memory", {
+			{ "limit_bytes", (int64_t)memoryBudget.getLimit() },
+			{ "peak_bytes", (int64_t)memoryBudget.getPeak() },
+			{ "waits", (int64_t)memoryBudget.getWaits() }
+		} });
+
+		printLatencyReport(zoomStats);
+		printIoReport(io);
+		writeStatsReport(statsFilename, shards, shard, wallSeconds, zoomStats, io, queueStats);
+	}
 
+	if (!traceFilename.empty())
+		writeTraceReport(traceFilename, shard);
 }
 
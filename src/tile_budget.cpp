@@ -0,0 +1,114 @@
+#include "tile_budget.h"
+#include <algorithm>
+#include <protozero/pbf_reader.hpp>
+
+using namespace std;
+
+// From the vector tile spec: Tile.layers, and Layer.name.
+#define TILE_LAYERS_TAG 3
+#define LAYER_NAME_TAG 1
+
+struct BudgetLayer {
+	size_t start;
+	size_t end;
+	std::string name;
+	size_t rank;
+	bool dropped;
+};
+
+size_t TileBudget::rank(const std::string& name) const {
+	for (size_t i = 0; i < priorities.size(); i++)
+		if (priorities[i] == name)
+			return priorities.size() - i;
+	return 0;
+}
+
+bool TileBudget::fit(const std::string& tile, std::string& output, const std::function<std::string(const std::string&)>& compress, std::vector<std::string>& dropped) const {
+	output = compress(tile);
+	if (!enabled() || output.size() <= maxBytes)
+		return true;
+
+	std::vector<BudgetLayer> layers;
+	protozero::pbf_reader reader{tile};
+	while (true) {
+		size_t start = reader.data().data() - tile.data();
+		if (!reader.next())
+			break;
+		if (reader.tag() != TILE_LAYERS_TAG || reader.wire_type() != protozero::pbf_wire_type::length_delimited) {
+			reader.skip();
+			continue;
+		}
+
+		protozero::pbf_reader layer{reader.get_view()};
+		std::string name;
+		if (layer.next(LAYER_NAME_TAG, protozero::pbf_wire_type::length_delimited))
+			name = layer.get_string();
+		size_t end = reader.data().data() - tile.data();
+		layers.push_back({ start, end, name, rank(name), false });
+	}
+	if (layers.size() < 2)
+		return false;
+
+	// The order to drop them in: the lowest rank first, and of those, the
+	// last in the tile.
+	std::vector<size_t> order(layers.size());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+		if (layers[a].rank != layers[b].rank)
+			return layers[a].rank < layers[b].rank;
+		return a > b;
+	});
+
+	// Compress the tile without the first `drops` layers in that order,
+	// copying the rest in their original order.
+	std::string smaller;
+	auto compressWithout = [&](size_t drops) {
+		for (size_t i = 0; i < order.size(); i++)
+			layers[order[i]].dropped = i < drops;
+
+		smaller.clear();
+		size_t copied = 0;
+		for (const auto& layer : layers) {
+			if (!layer.dropped)
+				continue;
+			smaller.append(tile, copied, layer.start - copied);
+			copied = layer.end;
+		}
+		smaller.append(tile, copied, std::string::npos);
+		return compress(smaller);
+	};
+
+	// Guess how many to drop from the layers' uncompressed sizes and the
+	// tile's compression ratio. Layers don't all compress alike, so the
+	// guess can be off either way.
+	const double ratio = (double)output.size() / tile.size();
+	size_t remaining = tile.size();
+	size_t drops = 0;
+	do {
+		const BudgetLayer& layer = layers[order[drops++]];
+		remaining -= layer.end - layer.start;
+	} while (drops < layers.size() - 1 && remaining * ratio > maxBytes);
+	output = compressWithout(drops);
+
+	if (output.size() <= maxBytes) {
+		// Too many, perhaps: put back the last ones dropped while it still
+		// fits. Dropping none is already known not to.
+		std::string candidate;
+		while (drops > 1) {
+			candidate = compressWithout(drops - 1);
+			if (candidate.size() > maxBytes)
+				break;
+			output.swap(candidate);
+			drops--;
+		}
+	} else {
+		// Too few: drop one more at a time.
+		while (drops < layers.size() - 1 && output.size() > maxBytes)
+			output = compressWithout(++drops);
+	}
+
+	for (size_t i = 0; i < drops; i++)
+		dropped.push_back(layers[order[i]].name);
+	return output.size() <= maxBytes;
+}
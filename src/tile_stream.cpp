@@ -0,0 +1,227 @@
+#include "tile_stream.h"
+#include "coordinates.h"
+#include "helpers.h"
+#include "mbtiles.h"
+#include "stats.h"
+#include "memory_budget.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define TILE_STREAM_HEADER_SIZE 13
+#define TILE_STREAM_METADATA_ZOOM 0xFF
+
+// Buffer up to this many bytes of records before writing them out.
+#define TILE_STREAM_BUFFER_SIZE (1 << 20)
+
+static void appendUint32(std::string& str, uint32_t value) {
+	for (int i = 0; i < 4; i++) {
+		str += (char)(value & 0xFF);
+		value >>= 8;
+	}
+}
+
+static uint32_t readUint32(const char* p) {
+	uint32_t rv = 0;
+	for (int i = 3; i >= 0; i--)
+		rv = (rv << 8) | (uint8_t)p[i];
+	return rv;
+}
+
+static uint64_t makeKey(uint64_t zoom, uint64_t x, uint64_t row) {
+	return (zoom << 58) | (x << 29) | row;
+}
+
+TileStream::TileStream():
+	lockfd(0)
+{
+}
+
+TileStream::~TileStream() {
+	if (lockfd > 0)
+		close(lockfd);
+	memoryBudget.releaseBuffered(data.size());
+}
+
+// ---- Write stream
+
+void TileStream::openForWriting(string &filename) {
+	this->filename = filename;
+
+	lockfd = open("./lockfile", O_CREAT, 0644);
+	if (lockfd == -1)
+		throw std::runtime_error("failed to open lockfile");
+}
+
+void TileStream::appendRecord(uint8_t zoom, uint32_t x, uint32_t y, const char* data, size_t size) {
+	buffer += (char)zoom;
+	appendUint32(buffer, x);
+	appendUint32(buffer, y);
+	appendUint32(buffer, size);
+	buffer.append(data, size);
+	memoryBudget.chargeBuffered(TILE_STREAM_HEADER_SIZE + size);
+
+	if (buffer.size() >= TILE_STREAM_BUFFER_SIZE || memoryBudget.shouldFlush(buffer.size()))
+		flush();
+}
+
+void TileStream::flush() {
+	if (buffer.empty())
+		return;
+
+	StageTimer timer(Stage::Flush);
+
+	// Other shards may be writing to the same stdout; only whole batches of
+	// records are written while holding the lock, so they never interleave.
+	Flock lock(lockfd);
+
+	const char* p = buffer.data();
+	size_t remaining = buffer.size();
+	while (remaining > 0) {
+		ssize_t n = write(STDOUT_FILENO, p, remaining);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			throw std::runtime_error(std::string("unable to write tile stream: ") + strerror(errno));
+		}
+		p += n;
+		remaining -= n;
+	}
+
+	memoryBudget.releaseBuffered(buffer.size());
+	buffer.clear();
+}
+
+void TileStream::writeMetadata(string key, string value) {
+	std::string blob = key;
+	blob += '\0';
+	blob += value;
+	appendRecord(TILE_STREAM_METADATA_ZOOM, 0, 0, blob.data(), blob.size());
+}
+
+void TileStream::saveTile(int zoom, int x, int y, string *data, bool /* isMerge */) {
+	appendRecord(zoom, x, (1 << zoom) - 1 - y, data->data(), data->size());
+}
+
+void TileStream::closeForWriting() {
+	flush();
+}
+
+// ---- Read stream
+
+void TileStream::openForReading(string &filename) {
+	this->filename = filename;
+
+	char buf[65536];
+	while (true) {
+		ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			throw std::runtime_error(std::string("unable to read tile stream: ") + strerror(errno));
+		}
+		if (n == 0)
+			break;
+		data.append(buf, n);
+		// Held until the end of the run, like an output's buffered records,
+		// so it counts against the budget without making the reader wait.
+		memoryBudget.chargeBuffered(n);
+	}
+
+	size_t offset = 0;
+	while (offset < data.size()) {
+		if (data.size() - offset < TILE_STREAM_HEADER_SIZE)
+			throw std::runtime_error("tile stream is truncated (partial record header)");
+
+		uint8_t zoom = data[offset];
+		uint32_t x = readUint32(&data[offset + 1]);
+		uint32_t y = readUint32(&data[offset + 5]);
+		uint32_t length = readUint32(&data[offset + 9]);
+		offset += TILE_STREAM_HEADER_SIZE;
+
+		if (data.size() - offset < length)
+			throw std::runtime_error("tile stream is truncated (partial record)");
+
+		if (zoom == TILE_STREAM_METADATA_ZOOM) {
+			const char* blob = &data[offset];
+			size_t keyLength = strnlen(blob, length);
+			std::string key(blob, keyLength);
+			std::string value;
+			if (keyLength < length)
+				value.assign(blob + keyLength + 1, length - keyLength - 1);
+			metadata.push_back(std::make_pair(key, value));
+		} else {
+			if (zoom > 28 || x >= (1u << zoom) || y >= (1u << zoom))
+				throw std::runtime_error("tile stream has an invalid tile z=" + std::to_string(zoom) + " x=" + std::to_string(x) + " y=" + std::to_string(y));
+
+			entries.push_back({ makeKey(zoom, x, (1 << zoom) - 1 - y), offset, length });
+		}
+
+		offset += length;
+	}
+
+	// Later records for the same tile win, as they would with REPLACE INTO.
+	std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.key < b.key; });
+	auto last = std::unique(entries.rbegin(), entries.rend(), [](const Entry& a, const Entry& b) { return a.key == b.key; });
+	entries.erase(entries.begin(), last.base());
+}
+
+std::vector<std::pair<std::string, std::string>> TileStream::readMetadata() {
+	return metadata;
+}
+
+void TileStream::readBoundingBox(double &minLon, double &maxLon, double &minLat, double &maxLat) {
+	minLon = -180; maxLon = 180;
+	minLat = MinLat; maxLat = MaxLat;
+
+	for (auto& entry : metadata) {
+		if (entry.first != "bounds")
+			continue;
+
+		vector<string> b = split_string(entry.second, ',');
+		minLon = stod(b[0]); minLat = stod(b[1]);
+		maxLon = stod(b[2]); maxLat = stod(b[3]);
+	}
+}
+
+void TileStream::populateTiles(bool verbose, std::vector<PreciseTileCoordinatesSet>& zooms, std::vector<Bbox>& extents) {
+	size_t tiles = 0;
+
+	for (const auto& entry : entries) {
+		// Mirror MBTiles::populateTiles, which skips gzipped empty tiles.
+		if (entry.length == 20)
+			continue;
+
+		size_t z = entry.key >> 58;
+		size_t col = (entry.key >> 29) & ((1 << 29) - 1);
+		size_t row = entry.key & ((1 << 29) - 1);
+		if (z >= zooms.size())
+			continue;
+
+		tiles++;
+		zooms[z].set(col, row);
+
+		if (col > extents[z].maxX) extents[z].maxX = col;
+		if (col < extents[z].minX) extents[z].minX = col;
+		if (row > extents[z].maxY) extents[z].maxY = row;
+		if (row < extents[z].minY) extents[z].minY = row;
+	}
+
+	if (verbose)
+		std::cout << filename << " had " << std::to_string(tiles) << " tiles" << std::endl;
+}
+
+protozero::data_view TileStream::readTile(int zoom, int col, int row, std::vector<char>& /* buffer */) {
+	uint64_t key = makeKey(zoom, col, row);
+	auto it = std::lower_bound(entries.begin(), entries.end(), key, [](const Entry& entry, uint64_t key) { return entry.key < key; });
+	if (it == entries.end() || it->key != key)
+		return {};
+
+	return { data.data() + it->offset, it->length };
+}
@@ -0,0 +1,341 @@
+#include "tilestats.h"
+#include "helpers.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <vtzero/vector_tile.hpp>
+
+using namespace std;
+
+#define TILESTATS_SHARD_PREFIX "./tilestats."
+
+static const char* geometryNames[] = { "Unknown", "Point", "LineString", "Polygon" };
+
+// ---- Numbers
+
+// The shortest text that reads back as the same double.
+static std::string formatNumber(double value) {
+	if (value == std::floor(value) && std::fabs(value) < 1e15)
+		return std::to_string((int64_t)value);
+
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.15g", value);
+	if (strtod(buf, NULL) != value)
+		snprintf(buf, sizeof(buf), "%.17g", value);
+	return buf;
+}
+
+// ---- Stats
+
+void AttributeStats::addString(const std::string& value) {
+	if (tracked() < TILESTATS_MAX_TRACKED_VALUES)
+		strings.insert(value);
+}
+
+void AttributeStats::addNumber(double value) {
+	if (!std::isfinite(value))
+		return;
+
+	addRange(value, value);
+	if (tracked() < TILESTATS_MAX_TRACKED_VALUES)
+		numbers.insert(value);
+}
+
+void AttributeStats::addRange(double min, double max) {
+	if (!hasRange || min < this->min)
+		this->min = min;
+	if (!hasRange || max > this->max)
+		this->max = max;
+	hasRange = true;
+}
+
+void AttributeStats::addBoolean(bool value) {
+	if (tracked() >= TILESTATS_MAX_TRACKED_VALUES)
+		return;
+	if (value)
+		hasTrue = true;
+	else
+		hasFalse = true;
+}
+
+void AttributeStats::merge(const AttributeStats& other) {
+	for (const auto& value : other.strings)
+		addString(value);
+	for (double value : other.numbers)
+		addNumber(value);
+	if (other.hasFalse)
+		addBoolean(false);
+	if (other.hasTrue)
+		addBoolean(true);
+	if (other.hasRange)
+		addRange(other.min, other.max);
+	reportedCount = std::max(reportedCount, other.reportedCount);
+	if (reportedType.empty())
+		reportedType = other.reportedType;
+}
+
+std::string AttributeStats::type() const {
+	int kinds = !strings.empty() + !numbers.empty() + (hasFalse || hasTrue);
+	if (kinds == 0)
+		return reportedType.empty() ? "mixed" : reportedType;
+	if (kinds > 1)
+		return "mixed";
+	if (!strings.empty())
+		return "string";
+	if (!numbers.empty())
+		return "number";
+	return "boolean";
+}
+
+void LayerStats::merge(const LayerStats& other) {
+	features += other.features;
+	for (int i = 0; i < 4; i++)
+		geometries[i] += other.geometries[i];
+	for (const auto& entry : other.attributes)
+		attributes[entry.first].merge(entry.second);
+}
+
+void TileStats::addTile(const std::string& tile) {
+	thread_local std::vector<uint64_t> pairs;
+
+	vtzero::vector_tile vectorTile{tile};
+	while (auto layer = vectorTile.next_layer()) {
+		LayerStats& stats = layers[std::string(layer.name())];
+
+		pairs.clear();
+		while (auto feature = layer.next_feature()) {
+			stats.features++;
+			int type = (int)feature.geometry_type();
+			stats.geometries[type >= 0 && type < 4 ? type : 0]++;
+			feature.for_each_property_indexes([&](const vtzero::index_value_pair& indexes) {
+				pairs.push_back((uint64_t)indexes.key().value() << 32 | indexes.value().value());
+				return true;
+			});
+		}
+
+		std::sort(pairs.begin(), pairs.end());
+		pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+		AttributeStats* attribute = NULL;
+		uint32_t lastKey = UINT32_MAX;
+		for (uint64_t pair : pairs) {
+			uint32_t key = pair >> 32;
+			if (key != lastKey) {
+				attribute = &stats.attributes[std::string(layer.key(key))];
+				lastKey = key;
+			}
+
+			vtzero::property_value value = layer.value((uint32_t)pair);
+			switch (value.type()) {
+				case vtzero::property_value_type::string_value: attribute->addString(std::string(value.string_value())); break;
+				case vtzero::property_value_type::float_value: attribute->addNumber(value.float_value()); break;
+				case vtzero::property_value_type::double_value: attribute->addNumber(value.double_value()); break;
+				case vtzero::property_value_type::int_value: attribute->addNumber(value.int_value()); break;
+				case vtzero::property_value_type::uint_value: attribute->addNumber(value.uint_value()); break;
+				case vtzero::property_value_type::sint_value: attribute->addNumber(value.sint_value()); break;
+				case vtzero::property_value_type::bool_value: attribute->addBoolean(value.bool_value()); break;
+			}
+		}
+	}
+}
+
+void TileStats::merge(const TileStats& other) {
+	for (const auto& entry : other.layers)
+		layers[entry.first].merge(entry.second);
+}
+
+void TileStats::addJson(const JsonValue& tilestats) {
+	const JsonValue* layerList = tilestats.get("layers");
+	if (!layerList || layerList->type != JsonValue::Type::Array)
+		throw std::runtime_error("tilestats has no layers");
+
+	for (const auto& layerJson : layerList->array) {
+		const JsonValue* name = layerJson.get("layer");
+		if (!name || name->type != JsonValue::Type::String)
+			throw std::runtime_error("tilestats layer has no name");
+
+		LayerStats layer;
+		const JsonValue* count = layerJson.get("count");
+		if (count && count->type == JsonValue::Type::Number)
+			layer.features = count->number;
+
+		// Only our own tilestats count each geometry type; others just give
+		// the most common one.
+		const JsonValue* geometryCounts = layerJson.get("geometryCounts");
+		const JsonValue* geometry = layerJson.get("geometry");
+		for (int i = 0; i < 4; i++) {
+			if (geometryCounts) {
+				const JsonValue* typeCount = geometryCounts->get(geometryNames[i]);
+				if (typeCount && typeCount->type == JsonValue::Type::Number)
+					layer.geometries[i] = typeCount->number;
+			} else if (geometry && geometry->string == geometryNames[i]) {
+				layer.geometries[i] = layer.features;
+			}
+		}
+
+		const JsonValue* attributes = layerJson.get("attributes");
+		if (attributes && attributes->type == JsonValue::Type::Array) {
+			for (const auto& attributeJson : attributes->array) {
+				const JsonValue* attributeName = attributeJson.get("attribute");
+				if (!attributeName || attributeName->type != JsonValue::Type::String)
+					continue;
+
+				AttributeStats& attribute = layer.attributes[attributeName->string];
+				const JsonValue* values = attributeJson.get("values");
+				if (values) {
+					for (const auto& value : values->array) {
+						if (value.type == JsonValue::Type::String)
+							attribute.addString(value.string);
+						else if (value.type == JsonValue::Type::Number)
+							attribute.addNumber(value.number);
+						else if (value.type == JsonValue::Type::Boolean)
+							attribute.addBoolean(value.boolean);
+					}
+				}
+
+				const JsonValue* min = attributeJson.get("min");
+				const JsonValue* max = attributeJson.get("max");
+				if (min && max && min->type == JsonValue::Type::Number && max->type == JsonValue::Type::Number)
+					attribute.addRange(min->number, max->number);
+
+				const JsonValue* attributeCount = attributeJson.get("count");
+				if (attributeCount && attributeCount->type == JsonValue::Type::Number)
+					attribute.reportedCount = std::max<uint64_t>(attribute.reportedCount, attributeCount->number);
+				const JsonValue* type = attributeJson.get("type");
+				if (type && type->type == JsonValue::Type::String)
+					attribute.reportedType = type->string;
+			}
+		}
+
+		layers[name->string].merge(layer);
+	}
+}
+
+std::string TileStats::toJson(size_t maxValues) const {
+	std::string json = "{\"layerCount\":" + std::to_string(layers.size()) + ",\"layers\":[";
+	bool firstLayer = true;
+	for (const auto& entry : layers) {
+		const LayerStats& layer = entry.second;
+		if (!firstLayer)
+			json += ",";
+		firstLayer = false;
+
+		// Like mapbox-geostats, name the most common geometry type.
+		int geometry = 0;
+		for (int i = 1; i < 4; i++)
+			if (layer.geometries[i] > layer.geometries[geometry])
+				geometry = i;
+
+		json += "{\"layer\":" + escapeJsonString(entry.first) +
+			",\"count\":" + std::to_string(layer.features) +
+			",\"geometry\":\"" + geometryNames[geometry] + "\"" +
+			",\"geometryCounts\":{";
+		for (int i = 0; i < 4; i++) {
+			if (i > 0)
+				json += ",";
+			json += std::string("\"") + geometryNames[i] + "\":" + std::to_string(layer.geometries[i]);
+		}
+		json += "},\"attributeCount\":" + std::to_string(layer.attributes.size()) + ",\"attributes\":[";
+
+		bool firstAttribute = true;
+		for (const auto& attributeEntry : layer.attributes) {
+			const AttributeStats& attribute = attributeEntry.second;
+			if (!firstAttribute)
+				json += ",";
+			firstAttribute = false;
+
+			json += "{\"attribute\":" + escapeJsonString(attributeEntry.first) +
+				",\"count\":" + std::to_string(attribute.count()) +
+				",\"type\":\"" + attribute.type() + "\",\"values\":[";
+
+			size_t written = 0;
+			auto separator = [&]() { return written++ > 0 ? "," : ""; };
+			if (attribute.hasFalse && written < maxValues)
+				json += std::string(separator()) + "false";
+			if (attribute.hasTrue && written < maxValues)
+				json += std::string(separator()) + "true";
+			for (auto it = attribute.numbers.begin(); it != attribute.numbers.end() && written < maxValues; ++it)
+				json += separator() + formatNumber(*it);
+			for (auto it = attribute.strings.begin(); it != attribute.strings.end() && written < maxValues; ++it)
+				json += separator() + escapeJsonString(*it);
+			json += "]";
+
+			if (attribute.hasRange)
+				json += ",\"min\":" + formatNumber(attribute.min) + ",\"max\":" + formatNumber(attribute.max);
+			json += "}";
+		}
+		json += "]}";
+	}
+	json += "]}";
+	return json;
+}
+
+// ---- Shards
+
+void clearShardTileStats(uint64_t shard) {
+	remove((TILESTATS_SHARD_PREFIX + std::to_string(shard)).c_str());
+}
+
+bool combineShardTileStats(uint64_t shards, uint64_t shard, const std::string& run, const TileStats& own, TileStats& total, std::vector<uint64_t>& otherRuns) {
+	int lockfd = open("./lockfile", O_CREAT, 0644);
+	if (lockfd == -1)
+		throw std::runtime_error("failed to open lockfile");
+	if (flock(lockfd, LOCK_EX) != 0) {
+		close(lockfd);
+		throw std::runtime_error("failed to flock");
+	}
+
+	bool last = true;
+	try {
+		{
+			std::ofstream out(TILESTATS_SHARD_PREFIX + std::to_string(shard));
+			out << run << "\n" << own.toJson(TILESTATS_MAX_TRACKED_VALUES);
+			if (!out)
+				throw std::runtime_error("unable to write " TILESTATS_SHARD_PREFIX + std::to_string(shard));
+		}
+
+		std::vector<std::string> partials;
+		std::vector<uint64_t> others;
+		for (uint64_t i = 0; i < shards; i++) {
+			std::ifstream in(TILESTATS_SHARD_PREFIX + std::to_string(i));
+			std::string fileRun;
+			if (!in || !std::getline(in, fileRun)) {
+				last = false;
+				break;
+			}
+			if (fileRun != run) {
+				others.push_back(i);
+				continue;
+			}
+			std::stringstream buffer;
+			buffer << in.rdbuf();
+			partials.push_back(buffer.str());
+		}
+
+		if (last) {
+			for (const auto& partial : partials)
+				total.addJson(parseJson(partial));
+			if (others.empty()) {
+				for (uint64_t i = 0; i < shards; i++)
+					remove((TILESTATS_SHARD_PREFIX + std::to_string(i)).c_str());
+			}
+			otherRuns = others;
+		}
+	} catch (...) {
+		flock(lockfd, LOCK_UN);
+		close(lockfd);
+		throw;
+	}
+
+	flock(lockfd, LOCK_UN);
+	close(lockfd);
+	return last;
+}
@@ -0,0 +1,108 @@
+#include <iostream>
+#include <fstream>
+#include <limits>
+#include <stdlib.h>
+#include "external/minunit.h"
+#include "directory_tiles.h"
+
+static std::string makeTempDirectory() {
+	char path[] = "/tmp/tile-smush-test-XXXXXX";
+	if (!mkdtemp(path))
+		throw std::runtime_error("mkdtemp failed");
+	return path;
+}
+
+static void removeDirectory(const std::string& path) {
+	std::string command = "rm -rf '" + path + "'";
+	if (system(command.c_str()) != 0)
+		std::cerr << "couldn't remove " << path << std::endl;
+}
+
+MU_TEST(test_round_trip) {
+	std::string root = makeTempDirectory();
+	std::string output = root + "/tiles";
+
+	{
+		DirectoryTiles writer(3);
+		writer.openForWriting(output);
+		writer.writeMetadata("name", "quote \" and é");
+		writer.writeMetadata("json", "{\"vector_layers\":[]}");
+		// Rows are TMS, so these are XYZ y=0 and y=3 at z2.
+		std::string a = "tile a", b = "tile b", c = "tile c";
+		writer.saveTile(0, 0, 0, &a, false);
+		writer.saveTile(2, 1, 3, &b, false);
+		writer.saveTile(2, 3, 0, &c, false);
+		writer.closeForWriting();
+	}
+
+	std::ifstream onDisk(output + "/2/1/0.pbf");
+	std::string contents((std::istreambuf_iterator<char>(onDisk)), std::istreambuf_iterator<char>());
+	mu_check(contents == "tile b");
+
+	DirectoryTiles reader(2);
+	reader.openForReading(output);
+
+	std::vector<PreciseTileCoordinatesSet> zooms;
+	std::vector<Bbox> extents;
+	for (int zoom = 0; zoom < 15; zoom++) {
+		zooms.push_back(PreciseTileCoordinatesSet(zoom));
+		extents.push_back({ std::numeric_limits<size_t>::max(), std::numeric_limits<size_t>::max(), 0, 0 });
+	}
+	reader.populateTiles(false, zooms, extents);
+	mu_check(zooms[0].size() == 1);
+	mu_check(zooms[1].size() == 0);
+	mu_check(zooms[2].size() == 2);
+	mu_check(zooms[2].test(1, 3) && zooms[2].test(3, 0));
+	mu_check(extents[2].minX == 1 && extents[2].maxX == 3 && extents[2].minY == 0 && extents[2].maxY == 3);
+
+	std::vector<char> buffer;
+	mu_check(std::string(reader.readTile(2, 3, 0, buffer)) == "tile c");
+	mu_check(reader.readTile(2, 0, 0, buffer).empty());
+
+	std::map<std::string, std::string> metadata;
+	for (const auto& entry : reader.readMetadata())
+		metadata[entry.first] = entry.second;
+	mu_check(metadata["name"] == "quote \" and é");
+	mu_check(metadata["json"] == "{\"vector_layers\":[]}");
+
+	// The zooms that weren't in metadata.json come from the tree.
+	mu_check(metadata["minzoom"] == "0");
+	mu_check(metadata["maxzoom"] == "2");
+
+	removeDirectory(root);
+}
+
+MU_TEST(test_write_error) {
+	std::string root = makeTempDirectory();
+	std::string output = root + "/tiles";
+
+	DirectoryTiles writer(2);
+	writer.openForWriting(output);
+
+	// A file where the z3 directory should be makes the writer thread fail;
+	// closeForWriting reports it.
+	std::ofstream(output + "/3").close();
+	std::string tile = "tile";
+	writer.saveTile(3, 0, 0, &tile, false);
+
+	bool threw = false;
+	try {
+		writer.closeForWriting();
+	} catch (std::runtime_error&) {
+		threw = true;
+	}
+	mu_check(threw);
+
+	removeDirectory(root);
+}
+
+MU_TEST_SUITE(test_suite_directory_tiles) {
+	MU_RUN_TEST(test_round_trip);
+	MU_RUN_TEST(test_write_error);
+}
+
+int main() {
+	MU_RUN_SUITE(test_suite_directory_tiles);
+	MU_REPORT();
+	return MU_EXIT_CODE;
+}
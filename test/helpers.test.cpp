@@ -1,6 +1,7 @@
 #include <iostream>
 #include "external/minunit.h"
 #include "helpers.h"
+#include "arena.h"
 
 MU_TEST(test_get_chunks) {
 	{
@@ -48,12 +49,92 @@ MU_TEST(test_get_chunks) {
 	}
 }
 
+MU_TEST(test_compression) {
+	// An uncompressed tile with one empty layer named "a".
+	std::string tile("\x1a\x05\x0a\x01\x61\x78\x02", 7);
+	mu_check(detect_compression(tile.data(), tile.size()) == TileCompression::None);
+
+	for (auto compression : { TileCompression::Gzip, TileCompression::Zlib, TileCompression::None }) {
+		std::string compressed = compress_tile(tile, compression, 6);
+		mu_check(detect_compression(compressed.data(), compressed.size()) == compression);
+
+		std::string roundTripped;
+		decompress_tile(roundTripped, compressed.data(), compressed.size());
+		mu_check(roundTripped == tile);
+	}
+
+	// Zlib doesn't record the uncompressed size, so this needs more than one
+	// attempt to decompress.
+	std::string large(1 << 20, 'x');
+	std::string compressed = compress_tile(large, TileCompression::Zlib, 6);
+	std::string roundTripped;
+	decompress_tile(roundTripped, compressed.data(), compressed.size());
+	mu_check(roundTripped == large);
+
+	TileCompression compression;
+	mu_check(parse_compression("zlib", compression));
+	mu_check(compression == TileCompression::Zlib);
+	mu_check(!parse_compression("brotli", compression));
+}
+
+MU_TEST(test_arena) {
+	Arena arena(1024);
+	char* a = static_cast<char*>(arena.allocate(3, 1));
+	uint64_t* b = static_cast<uint64_t*>(arena.allocate(sizeof(uint64_t), alignof(uint64_t)));
+	mu_check(reinterpret_cast<uintptr_t>(b) % alignof(uint64_t) == 0);
+	mu_check(reinterpret_cast<char*>(b) > a);
+
+	// Outgrowing the first chunk adds another; the next reset merges them.
+	arena.allocate(4000, 1);
+	mu_check(arena.capacity() > 1024);
+	size_t capacity = arena.capacity();
+	arena.reset();
+	mu_check(arena.capacity() == capacity);
+	char* c = static_cast<char*>(arena.allocate(4000, 1));
+	arena.reset();
+	mu_check(arena.allocate(4000, 1) == c);
+
+	std::vector<int, ArenaAllocator<int>> numbers{ArenaAllocator<int>(arena)};
+	for (int i = 0; i < 1000; i++)
+		numbers.push_back(i);
+	mu_check(numbers[999] == 999);
+}
+
+MU_TEST(test_zoom_levels) {
+	std::vector<int> levels(15, 6);
+	mu_check(parse_zoom_levels("9", levels));
+	mu_check(levels[0] == 9 && levels[14] == 9);
+
+	levels.assign(15, 6);
+	mu_check(parse_zoom_levels("0-8:12,9-12:9,14:4", levels));
+	mu_check(levels[0] == 12);
+	mu_check(levels[8] == 12);
+	mu_check(levels[9] == 9);
+	mu_check(levels[12] == 9);
+	mu_check(levels[13] == 6);
+	mu_check(levels[14] == 4);
+
+	mu_check(!parse_zoom_levels("13", levels));
+	mu_check(!parse_zoom_levels("0-8:13", levels));
+	mu_check(!parse_zoom_levels("8-0:6", levels));
+	mu_check(!parse_zoom_levels("0-15:6", levels));
+	mu_check(!parse_zoom_levels("0-8:6,", levels));
+	mu_check(!parse_zoom_levels("a-b:6", levels));
+}
+
 MU_TEST_SUITE(test_suite_get_chunks) {
 	MU_RUN_TEST(test_get_chunks);
 }
 
+MU_TEST_SUITE(test_suite_compression) {
+	MU_RUN_TEST(test_compression);
+	MU_RUN_TEST(test_arena);
+	MU_RUN_TEST(test_zoom_levels);
+}
+
 int main() {
 	MU_RUN_SUITE(test_suite_get_chunks);
+	MU_RUN_SUITE(test_suite_compression);
 	MU_REPORT();
 	return MU_EXIT_CODE;
 }
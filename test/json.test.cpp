@@ -0,0 +1,52 @@
+#include <iostream>
+#include "external/minunit.h"
+#include "json.h"
+
+MU_TEST(test_json) {
+	JsonValue value = parseJson(" {\"a\": [1, 2.50, true, null], \"b\": \"x\\\"\\u00e9\\ud83d\\ude00\", \"c\": {}} ");
+	mu_check(value.type == JsonValue::Type::Object);
+	mu_check(value.get("a")->array.size() == 4);
+	mu_check(value.get("a")->array[1].number == 2.5);
+	mu_check(value.get("b")->string == "x\"\xc3\xa9\xf0\x9f\x98\x80");
+	mu_check(value.get("d") == NULL);
+
+	// Numbers are written as they were read.
+	mu_check(writeJson(value) == "{\"a\":[1,2.50,true,null],\"b\":\"x\\\"\xc3\xa9\xf0\x9f\x98\x80\",\"c\":{}}");
+
+	bool threw = false;
+	try {
+		parseJson("{\"a\": }");
+	} catch (std::runtime_error&) {
+		threw = true;
+	}
+	mu_check(threw);
+}
+
+MU_TEST(test_vector_layers) {
+	VectorLayers layers;
+	layers.add(parseJson("[{\"id\":\"roads\",\"description\":\"{braces}\",\"minzoom\":4,\"maxzoom\":10,\"fields\":{\"kind\":\"String\"}}]"));
+	layers.add(parseJson("[{\"id\":\"water\",\"fields\":{}},{\"id\":\"roads\",\"minzoom\":2,\"maxzoom\":8,\"fields\":{\"kind\":\"Number\",\"lanes\":\"Number\"}}]"));
+
+	mu_check(layers.toJson() ==
+		"[{\"id\":\"roads\",\"description\":\"{braces}\",\"minzoom\":2,\"maxzoom\":10,\"fields\":{\"kind\":\"Mixed\",\"lanes\":\"Number\"}},"
+		"{\"id\":\"water\",\"fields\":{}}]");
+
+	bool threw = false;
+	try {
+		layers.add(parseJson("[{\"fields\":{}}]"));
+	} catch (std::runtime_error&) {
+		threw = true;
+	}
+	mu_check(threw);
+}
+
+MU_TEST_SUITE(test_suite_json) {
+	MU_RUN_TEST(test_json);
+	MU_RUN_TEST(test_vector_layers);
+}
+
+int main() {
+	MU_RUN_SUITE(test_suite_json);
+	MU_REPORT();
+	return MU_EXIT_CODE;
+}
@@ -0,0 +1,109 @@
+#include <iostream>
+#include "external/minunit.h"
+#include "layer_filter.h"
+#include <vtzero/builder.hpp>
+#include <vtzero/vector_tile.hpp>
+
+static std::string buildTile(const std::vector<std::string>& names) {
+	vtzero::tile_builder tile;
+	for (const auto& name : names) {
+		vtzero::layer_builder layer{tile, name};
+		vtzero::point_feature_builder feature{layer};
+		feature.set_id(7);
+		feature.add_point(1, 2);
+		feature.add_property("kind", name);
+		feature.commit();
+	}
+	return tile.serialize();
+}
+
+MU_TEST(test_apply) {
+	LayerFilter filter;
+	std::string renamed;
+	mu_check(filter.empty());
+	mu_check(filter.apply("roads", renamed) && renamed == "roads");
+
+	filter.excludes.push_back("debug_*");
+	filter.renames.push_back(std::make_pair("city_parks", "parks"));
+	mu_check(!filter.apply("debug_grid", renamed));
+	mu_check(filter.apply("city_parks", renamed) && renamed == "parks");
+
+	filter.includes.push_back("r*");
+	filter.includes.push_back("city_*");
+	mu_check(filter.apply("roads", renamed));
+	mu_check(filter.apply("city_parks", renamed));
+	mu_check(!filter.apply("water", renamed));
+}
+
+MU_TEST(test_filter_tile) {
+	LayerFilter filter;
+	filter.excludes.push_back("debug_*");
+	filter.renames.push_back(std::make_pair("city_parks", "parks"));
+
+	// Nothing to do: the tile is left alone.
+	std::string output = "untouched";
+	mu_check(!filter.filterTile(buildTile({ "roads", "water" }), output));
+	mu_check(output == "untouched");
+
+	mu_check(filter.filterTile(buildTile({ "roads", "debug_grid", "city_parks" }), output));
+	vtzero::vector_tile tile{output};
+	mu_check(tile.count_layers() == 2);
+	auto roads = tile.next_layer();
+	mu_check(std::string(roads.name()) == "roads");
+	auto parks = tile.next_layer();
+	mu_check(std::string(parks.name()) == "parks");
+
+	// The renamed layer keeps its features as they were.
+	auto feature = parks.next_feature();
+	mu_check(feature.id() == 7);
+	auto property = feature.next_property();
+	mu_check(std::string(property.key()) == "kind");
+	mu_check(std::string(property.value().string_value()) == "city_parks");
+
+	// Dropping every layer leaves an empty tile.
+	mu_check(filter.filterTile(buildTile({ "debug_grid" }), output));
+	mu_check(output.empty());
+}
+
+MU_TEST(test_rename_collision) {
+	LayerFilter filter;
+	filter.renames.push_back(std::make_pair("city_parks", "parks"));
+
+	// Renamed onto a layer the tile already has, it joins that layer.
+	std::string output;
+	mu_check(filter.filterTile(buildTile({ "parks", "roads", "city_parks" }), output));
+	vtzero::vector_tile tile{output};
+	mu_check(tile.count_layers() == 2);
+	auto parks = tile.next_layer();
+	mu_check(std::string(parks.name()) == "parks");
+	mu_check(parks.num_features() == 2);
+	auto feature = parks.next_feature();
+	mu_check(std::string(feature.next_property().value().string_value()) == "parks");
+	feature = parks.next_feature();
+	mu_check(feature.id() == 7);
+	mu_check(std::string(feature.next_property().value().string_value()) == "city_parks");
+	mu_check(std::string(tile.next_layer().name()) == "roads");
+}
+
+MU_TEST(test_filter_layer_list) {
+	LayerFilter filter;
+	filter.excludes.push_back("debug_*");
+	filter.renames.push_back(std::make_pair("city_parks", "parks"));
+
+	JsonValue layers = parseJson("[{\"id\":\"debug_grid\"},{\"id\":\"city_parks\",\"fields\":{}},{\"id\":\"roads\"}]");
+	filter.filterLayerList(layers, "id");
+	mu_check(writeJson(layers) == "[{\"id\":\"parks\",\"fields\":{}},{\"id\":\"roads\"}]");
+}
+
+MU_TEST_SUITE(test_suite_layer_filter) {
+	MU_RUN_TEST(test_apply);
+	MU_RUN_TEST(test_filter_tile);
+	MU_RUN_TEST(test_rename_collision);
+	MU_RUN_TEST(test_filter_layer_list);
+}
+
+int main() {
+	MU_RUN_SUITE(test_suite_layer_filter);
+	MU_REPORT();
+	return MU_EXIT_CODE;
+}
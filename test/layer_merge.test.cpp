@@ -0,0 +1,107 @@
+#include <iostream>
+#include "external/minunit.h"
+#include "layer_merge.h"
+#include <vtzero/builder.hpp>
+#include <vtzero/vector_tile.hpp>
+
+static std::string buildTile(const std::string& name, const std::string& kind, uint64_t id, uint32_t extent = 4096) {
+	vtzero::tile_builder tile;
+	vtzero::layer_builder layer{tile, name, 2, extent};
+	vtzero::point_feature_builder feature{layer};
+	feature.set_id(id);
+	feature.add_point(1, 2);
+	feature.add_property("kind", kind);
+	feature.add_property("source", "shared");
+	feature.commit();
+	return tile.serialize();
+}
+
+static std::vector<vtzero::layer> readLayers(const std::vector<std::string>& tiles) {
+	std::vector<vtzero::layer> layers;
+	readTileLayers(tiles, layers);
+	return layers;
+}
+
+MU_TEST(test_drop_duplicate_layers) {
+	std::vector<std::string> tiles = { buildTile("roads", "major", 1), buildTile("water", "lake", 2), buildTile("roads", "major", 1), buildTile("roads", "minor", 3) };
+
+	// Only the identical copy of roads goes.
+	std::vector<vtzero::layer> layers = readLayers(tiles);
+	mu_check(dropDuplicateLayers(layers, false) == 1);
+	mu_check(layers.size() == 3);
+	mu_check(layers[0].data().data() > tiles[0].data() && layers[0].data().data() < tiles[0].data() + tiles[0].size());
+	mu_check(std::string(layers[1].name()) == "water");
+	mu_check(std::string(layers[2].name()) == "roads");
+	mu_check(layers[2].next_feature().id() == 3);
+
+	// With input precedence, only the first roads is kept.
+	layers = readLayers(tiles);
+	mu_check(dropDuplicateLayers(layers, true) == 2);
+	mu_check(layers.size() == 2);
+	mu_check(layers[0].next_feature().id() == 1);
+	mu_check(std::string(layers[1].name()) == "water");
+}
+
+MU_TEST(test_distinct_layers) {
+	// Nothing shares a name, so there's nothing to merge.
+	std::vector<std::string> tiles = { buildTile("roads", "major", 1), buildTile("water", "lake", 2) };
+	std::vector<vtzero::layer> layers = readLayers(tiles);
+	std::string output = "untouched";
+	mu_check(!mergeTileLayers(layers, output));
+	mu_check(output == "untouched");
+}
+
+MU_TEST(test_merge_layers) {
+	std::vector<std::string> tiles = { buildTile("roads", "major", 1), buildTile("water", "lake", 2), buildTile("roads", "minor", 3) };
+	std::vector<vtzero::layer> layers = readLayers(tiles);
+	std::string output;
+	mu_check(mergeTileLayers(layers, output));
+
+	vtzero::vector_tile tile{output};
+	mu_check(tile.count_layers() == 2);
+	auto roads = tile.next_layer();
+	mu_check(std::string(roads.name()) == "roads");
+	mu_check(roads.num_features() == 2);
+
+	// The keys and the value they share are only in the tables once.
+	mu_check(roads.key_table().size() == 2);
+	mu_check(roads.value_table().size() == 3);
+
+	auto major = roads.next_feature();
+	mu_check(major.id() == 1);
+	mu_check(std::string(major.next_property().value().string_value()) == "major");
+	auto minor = roads.next_feature();
+	mu_check(minor.id() == 3);
+	mu_check(minor.geometry().type() == vtzero::GeomType::POINT);
+	auto kind = minor.next_property();
+	mu_check(std::string(kind.key()) == "kind");
+	mu_check(std::string(kind.value().string_value()) == "minor");
+	auto source = minor.next_property();
+	mu_check(std::string(source.value().string_value()) == "shared");
+
+	auto water = tile.next_layer();
+	mu_check(std::string(water.name()) == "water");
+	mu_check(water.num_features() == 1);
+
+	bool threw = false;
+	try {
+		tiles = { buildTile("roads", "major", 1), buildTile("roads", "minor", 3, 8192) };
+		layers = readLayers(tiles);
+		mergeTileLayers(layers, output);
+	} catch (std::runtime_error&) {
+		threw = true;
+	}
+	mu_check(threw);
+}
+
+MU_TEST_SUITE(test_suite_layer_merge) {
+	MU_RUN_TEST(test_drop_duplicate_layers);
+	MU_RUN_TEST(test_distinct_layers);
+	MU_RUN_TEST(test_merge_layers);
+}
+
+int main() {
+	MU_RUN_SUITE(test_suite_layer_merge);
+	MU_REPORT();
+	return MU_EXIT_CODE;
+}
@@ -0,0 +1,50 @@
+#include <iostream>
+#include "external/minunit.h"
+#include "numa.h"
+
+MU_TEST(test_parse_cpu_list) {
+	mu_check(parseCpuList("0") == std::vector<int>({ 0 }));
+	mu_check(parseCpuList("0-3\n") == std::vector<int>({ 0, 1, 2, 3 }));
+	mu_check(parseCpuList("0-1,8-9,12") == std::vector<int>({ 0, 1, 8, 9, 12 }));
+	mu_check(parseCpuList("").empty());
+}
+
+MU_TEST(test_tile_shard) {
+	// Without NUMA, tiles are dealt out round-robin.
+	mu_check(tileShard(14, 3, 5, 4, 1) == (3 * 16384 + 5) % 4);
+
+	// With 2 nodes and 5 shards, shards 0, 2 and 4 are on node 0. Every shard
+	// gets tiles, and each only gets tiles from its own node's columns.
+	uint64_t counts[5] = {};
+	bool local = true;
+	for (int x = 0; x < 1024; x++) {
+		for (int y = 0; y < 1024; y++) {
+			uint64_t shard = tileShard(10, x, y, 5, 2);
+			if (shard >= 5) {
+				local = false;
+				continue;
+			}
+			counts[shard]++;
+			for (int y2 = 0; y2 < 1024; y2 += 97)
+				if (tileShard(10, x, y2, 5, 2) % 2 != shard % 2)
+					local = false;
+		}
+	}
+	mu_check(local);
+	for (int i = 0; i < 5; i++)
+		mu_check(counts[i] > 0);
+
+	// The nodes get similar shares of the columns.
+	mu_check(counts[0] + counts[2] + counts[4] == counts[1] + counts[3]);
+}
+
+MU_TEST_SUITE(test_suite_numa) {
+	MU_RUN_TEST(test_parse_cpu_list);
+	MU_RUN_TEST(test_tile_shard);
+}
+
+int main() {
+	MU_RUN_SUITE(test_suite_numa);
+	MU_REPORT();
+	return MU_EXIT_CODE;
+}
@@ -0,0 +1,166 @@
+#include <iostream>
+#include <fstream>
+#include <limits>
+#include "external/minunit.h"
+#include "pmtiles.h"
+
+MU_TEST(test_tile_ids) {
+	// Examples from the PMTiles v3 spec.
+	mu_check(zxyToTileId(0, 0, 0) == 0);
+	mu_check(zxyToTileId(1, 0, 0) == 1);
+	mu_check(zxyToTileId(1, 0, 1) == 2);
+	mu_check(zxyToTileId(1, 1, 1) == 3);
+	mu_check(zxyToTileId(1, 1, 0) == 4);
+	mu_check(zxyToTileId(2, 0, 0) == 5);
+
+	// Every tile at low zooms survives a round trip.
+	bool ok = true;
+	for (uint8_t z = 0; z < 8; z++) {
+		for (uint32_t x = 0; x < (1u << z); x++) {
+			for (uint32_t y = 0; y < (1u << z); y++) {
+				uint8_t z2;
+				uint32_t x2, y2;
+				tileIdToZxy(zxyToTileId(z, x, y), z2, x2, y2);
+				if (z != z2 || x != x2 || y != y2)
+					ok = false;
+			}
+		}
+	}
+	mu_check(ok);
+
+	{
+		uint8_t z;
+		uint32_t x, y;
+		tileIdToZxy(zxyToTileId(14, 8000, 5123), z, x, y);
+		mu_check(z == 14);
+		mu_check(x == 8000);
+		mu_check(y == 5123);
+	}
+}
+
+static void appendUint64(std::string& out, uint64_t value) {
+	for (int i = 0; i < 8; i++)
+		out.push_back((char)(value >> (i * 8)));
+}
+
+static void appendVarint(std::string& out, uint64_t value) {
+	while (value >= 0x80) {
+		out.push_back((char)((value & 0x7f) | 0x80));
+		value >>= 7;
+	}
+	out.push_back((char)value);
+}
+
+struct TestEntry {
+	uint64_t tileId;
+	uint64_t runLength;
+	uint64_t length;
+	uint64_t offset; // as written: 0 continues from the previous entry, else offset + 1
+};
+
+static std::string encodeDirectory(const std::vector<TestEntry>& entries) {
+	std::string out;
+	appendVarint(out, entries.size());
+	uint64_t lastId = 0;
+	for (const auto& entry : entries) {
+		appendVarint(out, entry.tileId - lastId);
+		lastId = entry.tileId;
+	}
+	for (const auto& entry : entries)
+		appendVarint(out, entry.runLength);
+	for (const auto& entry : entries)
+		appendVarint(out, entry.length);
+	for (const auto& entry : entries)
+		appendVarint(out, entry.offset);
+	return out;
+}
+
+MU_TEST(test_read_archive) {
+	// Tile data: "aaaa" is shared by a run of two tiles and by tile 20,
+	// "bbbbbb" directly follows it, and "cc" is tile 0, from the root.
+	const std::string tileData = "aaaabbbbbbcc";
+	const std::string leaf = encodeDirectory({
+		{ 1, 2, 4, 1 },
+		{ 5, 1, 6, 0 },
+		{ 20, 1, 4, 1 }
+	});
+	const std::string root = encodeDirectory({
+		{ 0, 1, 2, 11 },
+		{ 1, 0, leaf.size(), 1 }
+	});
+
+	std::string archive = "PMTiles";
+	archive.push_back(3);
+	uint64_t rootOffset = PMTILES_HEADER_SIZE;
+	uint64_t leafOffset = rootOffset + root.size();
+	uint64_t tileDataOffset = leafOffset + leaf.size();
+	appendUint64(archive, rootOffset);
+	appendUint64(archive, root.size());
+	appendUint64(archive, 0); // no metadata
+	appendUint64(archive, 0);
+	appendUint64(archive, leafOffset);
+	appendUint64(archive, leaf.size());
+	appendUint64(archive, tileDataOffset);
+	appendUint64(archive, tileData.size());
+	appendUint64(archive, 5); // addressed tiles
+	appendUint64(archive, 4); // tile entries
+	appendUint64(archive, 3); // tile contents
+	archive.push_back(1); // clustered
+	archive.push_back(PMTILES_COMPRESSION_NONE); // internal compression
+	archive.push_back(PMTILES_COMPRESSION_NONE); // tile compression
+	archive.push_back(1); // MVT
+	archive.push_back(0); // minzoom
+	archive.push_back(2); // maxzoom
+	archive.resize(PMTILES_HEADER_SIZE, 0);
+	archive += root + leaf + tileData;
+
+	std::string filename = "/tmp/tile-smush-test.pmtiles";
+	{
+		std::ofstream out(filename, std::ios::binary);
+		out << archive;
+	}
+
+	PMTiles pmtiles;
+	pmtiles.openForReading(filename);
+
+	// Rows are TMS, so XYZ y=0 at z1 is row 1.
+	std::vector<char> buffer;
+	mu_check(std::string(pmtiles.readTile(0, 0, 0, buffer)) == "cc");
+	mu_check(std::string(pmtiles.readTile(1, 0, 1, buffer)) == "aaaa");
+	mu_check(std::string(pmtiles.readTile(1, 0, 0, buffer)) == "aaaa");
+	mu_check(pmtiles.readTile(1, 1, 0, buffer).empty());
+	mu_check(std::string(pmtiles.readTile(2, 0, 3, buffer)) == "bbbbbb");
+
+	uint8_t z;
+	uint32_t x, y;
+	tileIdToZxy(20, z, x, y);
+	mu_check(std::string(pmtiles.readTile(z, x, (1 << z) - 1 - y, buffer)) == "aaaa");
+
+	std::vector<PreciseTileCoordinatesSet> zooms;
+	std::vector<Bbox> extents;
+	for (int zoom = 0; zoom < 15; zoom++) {
+		zooms.push_back(PreciseTileCoordinatesSet(zoom));
+		extents.push_back({ std::numeric_limits<size_t>::max(), std::numeric_limits<size_t>::max(), 0, 0 });
+	}
+	pmtiles.populateTiles(false, zooms, extents);
+	mu_check(zooms[0].size() == 1);
+	mu_check(zooms[1].size() == 2);
+	mu_check(zooms[1].test(0, 0) && zooms[1].test(0, 1) && !zooms[1].test(1, 0));
+	mu_check(zooms[2].size() == 2);
+	mu_check(zooms[2].test(0, 3));
+	mu_check(zooms[z].test(x, (1 << z) - 1 - y));
+	mu_check(extents[1].minX == 0 && extents[1].maxX == 0 && extents[1].minY == 0 && extents[1].maxY == 1);
+
+	remove(filename.c_str());
+}
+
+MU_TEST_SUITE(test_suite_tile_ids) {
+	MU_RUN_TEST(test_tile_ids);
+	MU_RUN_TEST(test_read_archive);
+}
+
+int main() {
+	MU_RUN_SUITE(test_suite_tile_ids);
+	MU_REPORT();
+	return MU_EXIT_CODE;
+}
@@ -0,0 +1,84 @@
+#include <iostream>
+#include <cstdio>
+#include "external/minunit.h"
+#include "mbtiles.h"
+
+// A deterministic tile whose size varies from empty to several pages, so that
+// some tiles spill onto overflow chains.
+static std::string makeTile(int x, int y) {
+	size_t size = ((x * 7919 + y * 104729) % 40) * 250;
+	std::string tile(size, '\0');
+	for (size_t i = 0; i < size; i++)
+		tile[i] = (char)((x + y + i) * 31);
+	return tile;
+}
+
+static void writeFixture(const std::string& filename, int pageSize) {
+	remove(filename.c_str());
+	sqlite::database db(filename);
+	db << "PRAGMA page_size = " + std::to_string(pageSize);
+	db << "CREATE TABLE tiles (zoom_level integer, tile_column integer, tile_row integer, tile_data blob);";
+	db << "CREATE UNIQUE INDEX tile_index on tiles (zoom_level, tile_column, tile_row);";
+	db << "BEGIN";
+	for (int x = 0; x < 64; x++) {
+		for (int y = 0; y < 64; y++) {
+			// Leave holes, and insert out of order so the rowids don't follow
+			// the index.
+			if ((x + y) % 5 == 0)
+				continue;
+			std::string tile = makeTile(x, y);
+			std::vector<char> blob(tile.begin(), tile.end());
+			db << "INSERT INTO tiles VALUES (?, ?, ?, ?)" << 12 << (63 - x) << y << blob;
+		}
+	}
+	db << "COMMIT";
+}
+
+static bool readsMatch(const std::string& filename) {
+	MBTilesReadOptions options;
+	options.directBtree = true;
+	MBTiles direct(options), viaSqlite;
+	std::string name = filename;
+	direct.openForReading(name);
+	viaSqlite.openForReading(name);
+
+	std::vector<char> directBuffer, sqliteBuffer;
+	for (int x = 0; x < 64; x++) {
+		for (int y = 0; y < 64; y++) {
+			protozero::data_view a = direct.readTile(12, 63 - x, y, directBuffer);
+			protozero::data_view b = viaSqlite.readTile(12, 63 - x, y, sqliteBuffer);
+			std::string expected = (x + y) % 5 == 0 ? "" : makeTile(x, y);
+			if (std::string(a.data(), a.size()) != expected || std::string(b.data(), b.size()) != expected)
+				return false;
+		}
+	}
+
+	// Tiles that would sort before, between and after the real ones.
+	if (direct.readTile(11, 0, 0, directBuffer).data() != nullptr ||
+		direct.readTile(12, 64, 0, directBuffer).data() != nullptr ||
+		direct.readTile(13, 0, 0, directBuffer).data() != nullptr)
+		return false;
+
+	return true;
+}
+
+MU_TEST(test_btree_reads) {
+	// Small pages give a deep tree and long overflow chains.
+	writeFixture("/tmp/tile-smush-btree-test.mbtiles", 512);
+	mu_check(readsMatch("/tmp/tile-smush-btree-test.mbtiles"));
+
+	writeFixture("/tmp/tile-smush-btree-test.mbtiles", 4096);
+	mu_check(readsMatch("/tmp/tile-smush-btree-test.mbtiles"));
+
+	remove("/tmp/tile-smush-btree-test.mbtiles");
+}
+
+MU_TEST_SUITE(test_suite_btree) {
+	MU_RUN_TEST(test_btree_reads);
+}
+
+int main() {
+	MU_RUN_SUITE(test_suite_btree);
+	MU_REPORT();
+	return MU_EXIT_CODE;
+}
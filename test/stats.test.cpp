@@ -0,0 +1,49 @@
+#include <iostream>
+#include "external/minunit.h"
+#include "stats.h"
+
+MU_TEST(test_histogram) {
+	Histogram empty;
+	mu_check(empty.count() == 0);
+	mu_check(empty.percentile(0.5) == 0);
+
+	// Small values are exact.
+	Histogram small;
+	for (uint64_t i = 1; i <= 10; i++)
+		small.record(i);
+	mu_check(small.count() == 10);
+	mu_check(small.percentile(0.5) == 5);
+	mu_check(small.percentile(1) == 10);
+	mu_check(small.max() == 10);
+
+	// Large values are within a bucket's width, and never above the max.
+	Histogram large;
+	for (uint64_t i = 1; i <= 1000; i++)
+		large.record(i * 1000);
+	uint64_t p50 = large.percentile(0.5);
+	mu_check(p50 >= 500000 && p50 <= 500000 * 1.07);
+	mu_check(large.percentile(0.999) <= 1000000);
+	mu_check(large.max() == 1000000);
+
+	// One giant outlier shows up in the max but not the median.
+	large.record(60ull * 1000 * 1000 * 1000);
+	mu_check(large.max() == 60ull * 1000 * 1000 * 1000);
+	mu_check(large.percentile(0.5) == p50);
+
+	Histogram merged;
+	merged.merge(small);
+	merged.merge(large);
+	mu_check(merged.count() == 1011);
+	mu_check(merged.max() == large.max());
+	mu_check(merged.percentile(0.001) <= 2);
+}
+
+MU_TEST_SUITE(test_suite_histogram) {
+	MU_RUN_TEST(test_histogram);
+}
+
+int main() {
+	MU_RUN_SUITE(test_suite_histogram);
+	MU_REPORT();
+	return MU_EXIT_CODE;
+}
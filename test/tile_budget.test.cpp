@@ -0,0 +1,136 @@
+#include <iostream>
+#include "external/minunit.h"
+#include "tile_budget.h"
+#include "helpers.h"
+#include <vtzero/builder.hpp>
+#include <vtzero/vector_tile.hpp>
+
+// A layer with one feature whose property takes up about `bytes`.
+static void addLayer(vtzero::tile_builder& tile, const std::string& name, size_t bytes) {
+	vtzero::layer_builder layer{tile, name};
+	vtzero::point_feature_builder feature{layer};
+	feature.add_point(1, 2);
+	feature.add_property("padding", std::string(bytes, 'x'));
+	feature.commit();
+}
+
+static std::string buildTile() {
+	vtzero::tile_builder tile;
+	addLayer(tile, "roads", 100);
+	addLayer(tile, "buildings", 1000);
+	addLayer(tile, "water", 100);
+	addLayer(tile, "pois", 500);
+	return tile.serialize();
+}
+
+static std::string noCompression(const std::string& tile) {
+	return tile;
+}
+
+static std::string gzip(const std::string& tile) {
+	return compress_tile(tile, TileCompression::Gzip, 6);
+}
+
+// Bytes that gzip can't shrink.
+static std::string noise(size_t bytes) {
+	std::string rv;
+	uint32_t state = 12345;
+	for (size_t i = 0; i < bytes; i++) {
+		state = state * 1103515245 + 12345;
+		rv += (char)(state >> 24);
+	}
+	return rv;
+}
+
+static std::vector<std::string> layerNames(const std::string& data) {
+	std::vector<std::string> names;
+	vtzero::vector_tile tile{data};
+	while (auto layer = tile.next_layer())
+		names.push_back(std::string(layer.name()));
+	return names;
+}
+
+MU_TEST(test_fits) {
+	TileBudget budget;
+	budget.maxBytes = 10000;
+	std::string tile = buildTile();
+	std::string output;
+	std::vector<std::string> dropped;
+	mu_check(budget.fit(tile, output, noCompression, dropped));
+	mu_check(output == tile);
+	mu_check(dropped.empty());
+}
+
+MU_TEST(test_drop_by_priority) {
+	TileBudget budget;
+	budget.maxBytes = 1500;
+	budget.priorities = { "roads", "buildings" };
+	std::string output;
+	std::vector<std::string> dropped;
+
+	// Unlisted layers go first, the last in the tile first: dropping pois
+	// is enough.
+	mu_check(budget.fit(buildTile(), output, noCompression, dropped));
+	mu_check(dropped == std::vector<std::string>({ "pois" }));
+	mu_check(layerNames(output) == std::vector<std::string>({ "roads", "buildings", "water" }));
+
+	// Then the listed ones, least important first.
+	budget.maxBytes = 500;
+	dropped.clear();
+	mu_check(budget.fit(buildTile(), output, noCompression, dropped));
+	mu_check(dropped == std::vector<std::string>({ "pois", "water", "buildings" }));
+	mu_check(layerNames(output) == std::vector<std::string>({ "roads" }));
+
+	// The last layer is kept even if it doesn't fit.
+	budget.maxBytes = 10;
+	dropped.clear();
+	mu_check(!budget.fit(buildTile(), output, noCompression, dropped));
+	mu_check(dropped.size() == 3);
+	mu_check(layerNames(output) == std::vector<std::string>({ "roads" }));
+}
+
+MU_TEST(test_uneven_compression) {
+	// Two layers that compress to almost nothing, then one that doesn't
+	// compress at all.
+	vtzero::tile_builder small;
+	addLayer(small, "j", 1000);
+	addLayer(small, "k", 1000);
+	std::string smallTile = small.serialize();
+
+	vtzero::tile_builder builder;
+	addLayer(builder, "j", 1000);
+	addLayer(builder, "k", 1000);
+	{
+		vtzero::layer_builder layer{builder, "d1"};
+		vtzero::point_feature_builder feature{layer};
+		feature.add_point(1, 2);
+		feature.add_property("padding", noise(1000));
+		feature.commit();
+	}
+	std::string tile = builder.serialize();
+
+	// By the tile's overall ratio, j and k would be too big to keep, but
+	// dropping d1 is enough.
+	TileBudget budget;
+	budget.maxBytes = gzip(smallTile).size();
+	std::string output;
+	std::vector<std::string> dropped;
+	mu_check(budget.fit(tile, output, gzip, dropped));
+	mu_check(dropped == std::vector<std::string>({ "d1" }));
+	mu_check(output.size() <= budget.maxBytes);
+	std::string decompressed;
+	decompress_tile(decompressed, output.data(), output.size());
+	mu_check(layerNames(decompressed) == std::vector<std::string>({ "j", "k" }));
+}
+
+MU_TEST_SUITE(test_suite_tile_budget) {
+	MU_RUN_TEST(test_fits);
+	MU_RUN_TEST(test_drop_by_priority);
+	MU_RUN_TEST(test_uneven_compression);
+}
+
+int main() {
+	MU_RUN_SUITE(test_suite_tile_budget);
+	MU_REPORT();
+	return MU_EXIT_CODE;
+}
@@ -0,0 +1,132 @@
+#include <iostream>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <fcntl.h>
+#include <unistd.h>
+#include "external/minunit.h"
+#include "tile_stream.h"
+
+#define TEST_STREAM_FILENAME "/tmp/tile-smush-test.stream"
+
+// Run fn with `fd` standing in for stdin or stdout.
+static void withFd(int target, int fd, const std::function<void()>& fn) {
+	fflush(stdout);
+	int saved = dup(target);
+	dup2(fd, target);
+	close(fd);
+	try {
+		fn();
+	} catch (...) {
+		dup2(saved, target);
+		close(saved);
+		throw;
+	}
+	dup2(saved, target);
+	close(saved);
+}
+
+static void writeStream(const std::function<void(TileStream&)>& fn) {
+	withFd(STDOUT_FILENO, open(TEST_STREAM_FILENAME, O_WRONLY | O_CREAT | O_TRUNC, 0644), [&]() {
+		TileStream stream;
+		std::string filename = TILE_STREAM_FILENAME;
+		stream.openForWriting(filename);
+		fn(stream);
+		stream.closeForWriting();
+	});
+}
+
+static void readStream(TileStream& stream) {
+	withFd(STDIN_FILENO, open(TEST_STREAM_FILENAME, O_RDONLY), [&]() {
+		std::string filename = TILE_STREAM_FILENAME;
+		stream.openForReading(filename);
+	});
+}
+
+MU_TEST(test_round_trip) {
+	writeStream([](TileStream& stream) {
+		stream.writeMetadata("name", "test");
+		stream.writeMetadata("json", "{\"vector_layers\":[]}");
+		// Rows are TMS.
+		std::string a = "tile a", b = "tile b", replaced = "tile b, again";
+		stream.saveTile(0, 0, 0, &a, false);
+		stream.saveTile(3, 5, 1, &b, false);
+		stream.saveTile(3, 5, 1, &replaced, false);
+	});
+
+	// On the wire, y is XYZ: z3 row 1 is y=6.
+	std::ifstream in(TEST_STREAM_FILENAME, std::ios::binary);
+	std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	const char expected[] = "\x03\x05\x00\x00\x00\x06\x00\x00\x00\x06\x00\x00\x00tile b";
+	mu_check(contents.find(std::string(expected, sizeof(expected) - 1)) != std::string::npos);
+
+	TileStream stream;
+	readStream(stream);
+
+	auto metadata = stream.readMetadata();
+	mu_check(metadata.size() == 2);
+	mu_check(metadata[0].first == "name" && metadata[0].second == "test");
+	mu_check(metadata[1].second == "{\"vector_layers\":[]}");
+
+	std::vector<char> buffer;
+	mu_check(std::string(stream.readTile(0, 0, 0, buffer)) == "tile a");
+	mu_check(std::string(stream.readTile(3, 5, 1, buffer)) == "tile b, again");
+	mu_check(stream.readTile(3, 5, 2, buffer).empty());
+
+	std::vector<PreciseTileCoordinatesSet> zooms;
+	std::vector<Bbox> extents;
+	for (int zoom = 0; zoom < 15; zoom++) {
+		zooms.push_back(PreciseTileCoordinatesSet(zoom));
+		extents.push_back({ std::numeric_limits<size_t>::max(), std::numeric_limits<size_t>::max(), 0, 0 });
+	}
+	stream.populateTiles(false, zooms, extents);
+	mu_check(zooms[0].size() == 1);
+	mu_check(zooms[3].size() == 1);
+	mu_check(zooms[3].test(5, 1));
+}
+
+MU_TEST(test_truncated) {
+	writeStream([](TileStream& stream) {
+		std::string tile = "tile";
+		stream.saveTile(1, 0, 0, &tile, false);
+	});
+
+	// Cut the blob short.
+	if (truncate(TEST_STREAM_FILENAME, 15) != 0)
+		mu_fail("truncate failed");
+
+	bool threw = false;
+	try {
+		TileStream stream;
+		readStream(stream);
+	} catch (std::runtime_error&) {
+		threw = true;
+	}
+	mu_check(threw);
+
+	// And the header.
+	if (truncate(TEST_STREAM_FILENAME, 5) != 0)
+		mu_fail("truncate failed");
+
+	threw = false;
+	try {
+		TileStream stream;
+		readStream(stream);
+	} catch (std::runtime_error&) {
+		threw = true;
+	}
+	mu_check(threw);
+
+	remove(TEST_STREAM_FILENAME);
+}
+
+MU_TEST_SUITE(test_suite_tile_stream) {
+	MU_RUN_TEST(test_round_trip);
+	MU_RUN_TEST(test_truncated);
+}
+
+int main() {
+	MU_RUN_SUITE(test_suite_tile_stream);
+	MU_REPORT();
+	return MU_EXIT_CODE;
+}
@@ -0,0 +1,104 @@
+#include <iostream>
+#include <fstream>
+#include "external/minunit.h"
+#include "tilestats.h"
+#include <vtzero/builder.hpp>
+
+static std::string buildTile() {
+	vtzero::tile_builder tile;
+	vtzero::layer_builder roads{tile, "roads"};
+	for (int i = 0; i < 3; i++) {
+		vtzero::linestring_feature_builder feature{roads};
+		feature.add_linestring(2);
+		feature.set_point(0, 0);
+		feature.set_point(10, 10);
+		feature.add_property("kind", i == 2 ? "minor" : "major");
+		feature.add_property("lanes", vtzero::sint_value_type(i + 1));
+		feature.commit();
+	}
+
+	vtzero::layer_builder pois{tile, "pois"};
+	vtzero::point_feature_builder poi{pois};
+	poi.add_point(5, 5);
+	poi.add_property("open", true);
+	poi.commit();
+
+	return tile.serialize();
+}
+
+MU_TEST(test_tilestats) {
+	TileStats stats;
+	stats.addTile(buildTile());
+	stats.addTile(buildTile());
+
+	const LayerStats& roads = stats.layers["roads"];
+	mu_check(roads.features == 6);
+	mu_check(roads.geometries[2] == 6);
+	mu_check(roads.attributes.at("kind").count() == 2);
+	mu_check(roads.attributes.at("kind").type() == "string");
+	mu_check(roads.attributes.at("lanes").min == 1);
+	mu_check(roads.attributes.at("lanes").max == 3);
+	mu_check(stats.layers["pois"].attributes.at("open").type() == "boolean");
+
+	JsonValue json = parseJson(stats.toJson());
+	mu_check(json.get("layerCount")->number == 2);
+	const JsonValue& pois = json.get("layers")->array[0];
+	mu_check(pois.get("layer")->string == "pois");
+	mu_check(pois.get("geometry")->string == "Point");
+
+	// Reading our own output back gives the same stats, and merging adds
+	// up the counts.
+	TileStats roundTripped;
+	roundTripped.addJson(json);
+	mu_check(roundTripped.toJson() == stats.toJson());
+	roundTripped.merge(stats);
+	mu_check(roundTripped.layers["roads"].features == 12);
+	mu_check(roundTripped.layers["roads"].attributes.at("kind").count() == 2);
+
+	// Values past the limit aren't kept, but still count towards the range.
+	AttributeStats attribute;
+	for (int i = 0; i < TILESTATS_MAX_TRACKED_VALUES + 10; i++)
+		attribute.addNumber(i);
+	mu_check(attribute.count() == TILESTATS_MAX_TRACKED_VALUES);
+	mu_check(attribute.max == TILESTATS_MAX_TRACKED_VALUES + 9);
+}
+
+MU_TEST(test_combine_shards) {
+	TileStats own;
+	own.addTile(buildTile());
+	TileStats total;
+	std::vector<uint64_t> otherRuns;
+
+	// Shard 1 hasn't finished.
+	clearShardTileStats(0);
+	clearShardTileStats(1);
+	mu_check(!combineShardTileStats(2, 0, "out.mbtiles 1", own, total, otherRuns));
+
+	// Now it has: it's last, and combines both.
+	mu_check(combineShardTileStats(2, 1, "out.mbtiles 1", own, total, otherRuns));
+	mu_check(otherRuns.empty());
+	mu_check(total.layers["roads"].features == 6);
+
+	// A file from another run doesn't count, but once every shard has one,
+	// the metadata is still written.
+	std::ofstream("./tilestats.1") << "out.mbtiles 0\n{\"layers\":[]}";
+	total = TileStats();
+	mu_check(combineShardTileStats(2, 0, "out.mbtiles 1", own, total, otherRuns));
+	mu_check(otherRuns == std::vector<uint64_t>({ 1 }));
+	mu_check(total.layers["roads"].features == 3);
+
+	clearShardTileStats(0);
+	clearShardTileStats(1);
+	remove("./lockfile");
+}
+
+MU_TEST_SUITE(test_suite_tilestats) {
+	MU_RUN_TEST(test_tilestats);
+	MU_RUN_TEST(test_combine_shards);
+}
+
+int main() {
+	MU_RUN_SUITE(test_suite_tilestats);
+	MU_REPORT();
+	return MU_EXIT_CODE;
+}